@@ -170,10 +170,13 @@ main(int argc, char** argv)
         return 1;
     }
 
-    // create the input stream
+    // create the input stream, mapping the file in memory when possible
     AP4_Result result;
     AP4_ByteStream* input = NULL;
-    result = AP4_FileByteStream::Create(input_filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+    result = AP4_MmapFileByteStream::Create(input_filename, AP4_MmapFileByteStream::ACCESS_SEQUENTIAL, input);
+    if (AP4_FAILED(result)) {
+        result = AP4_FileByteStream::Create(input_filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+    }
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file (%s) %d\n", input_filename, result);
         return 1;
@@ -266,5 +269,5 @@ main(int argc, char** argv)
     input->Release();
     output->Release();
 
-    return 0;
+    return AP4_FAILED(result) ? 1 : 0;
 }
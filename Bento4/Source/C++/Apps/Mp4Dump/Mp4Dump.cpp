@@ -304,7 +304,12 @@ main(int argc, char** argv)
 #else
             filename = arg;
 #endif
-            AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+            // map the file in memory when possible, without reading ahead through
+            // the media data that is skipped over
+            AP4_Result result = AP4_MmapFileByteStream::Create(filename, AP4_MmapFileByteStream::ACCESS_RANDOM, input);
+            if (AP4_FAILED(result)) {
+                result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+            }
 
 #ifdef __EMSCRIPTEN__
             free(mounted_filename);
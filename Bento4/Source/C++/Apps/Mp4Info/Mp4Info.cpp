@@ -1888,10 +1888,16 @@ main(int argc, char** argv)
         return 1;
     }
 
+    // open the input, mapping the file in memory when possible
     AP4_ByteStream* input = NULL;
-    AP4_Result result = AP4_FileByteStream::Create(filename, 
-                                                   AP4_FileByteStream::STREAM_MODE_READ, 
-                                                   input);
+    AP4_Result result = AP4_MmapFileByteStream::Create(filename, 
+                                                       AP4_MmapFileByteStream::ACCESS_NORMAL, 
+                                                       input);
+    if (AP4_FAILED(result)) {
+        result = AP4_FileByteStream::Create(filename, 
+                                            AP4_FileByteStream::STREAM_MODE_READ, 
+                                            input);
+    }
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file %s (%d)\n", filename, result);
         return 1;
@@ -43,6 +43,11 @@
 #include "Ap4Sample.h"
 #include "Ap4Atom.h"
 
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Cardinal AP4_ATOM_SAMPLE_TABLE_MAX_INDEXED_SAMPLES = 0x1000000; // 128MB of index, for sanity
+
 /*----------------------------------------------------------------------
 |   AP4_AtomSampleTable Dynamic Cast Anchor
 +---------------------------------------------------------------------*/
@@ -54,7 +59,12 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_AtomSampleTable)
 +---------------------------------------------------------------------*/
 AP4_AtomSampleTable::AP4_AtomSampleTable(AP4_ContainerAtom* stbl, 
                                          AP4_ByteStream&    sample_stream) :
-    m_SampleStream(sample_stream)
+    m_SampleStream(sample_stream),
+    m_SampleOffsetIndexState(SAMPLE_OFFSET_INDEX_NONE),
+    m_IndexedSampleCount(0),
+    m_SampleChunks(NULL),
+    m_SampleChunkOffsets(NULL),
+    m_ChunkDescriptions(NULL)
 {
     m_StscAtom = AP4_DYNAMIC_CAST(AP4_StscAtom, stbl->GetChild(AP4_ATOM_TYPE_STSC));
     m_StcoAtom = AP4_DYNAMIC_CAST(AP4_StcoAtom, stbl->GetChild(AP4_ATOM_TYPE_STCO));
@@ -75,9 +85,88 @@ AP4_AtomSampleTable::AP4_AtomSampleTable(AP4_ContainerAtom* stbl,
 +---------------------------------------------------------------------*/
 AP4_AtomSampleTable::~AP4_AtomSampleTable()
 {
+    ResetSampleOffsetIndex();
     m_SampleStream.Release();
 }
 
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::ResetSampleOffsetIndex
++---------------------------------------------------------------------*/
+void
+AP4_AtomSampleTable::ResetSampleOffsetIndex()
+{
+    delete[] m_SampleChunks;
+    delete[] m_SampleChunkOffsets;
+    delete[] m_ChunkDescriptions;
+    m_SampleChunks       = NULL;
+    m_SampleChunkOffsets = NULL;
+    m_ChunkDescriptions  = NULL;
+    m_IndexedSampleCount = 0;
+    m_SampleOffsetIndexState = SAMPLE_OFFSET_INDEX_NONE;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::BuildSampleOffsetIndex
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_AtomSampleTable::BuildSampleOffsetIndex()
+{
+    // check that we have the tables we need
+    if (m_StscAtom == NULL) return AP4_ERROR_INVALID_FORMAT;
+    if (m_StszAtom == NULL && m_Stz2Atom == NULL) return AP4_ERROR_INVALID_FORMAT;
+    AP4_Cardinal chunk_count;
+    if (m_StcoAtom) {
+        chunk_count = m_StcoAtom->GetChunkCount();
+    } else if (m_Co64Atom) {
+        chunk_count = m_Co64Atom->GetChunkCount();
+    } else {
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+    AP4_Cardinal sample_count = GetSampleCount();
+    if (sample_count > AP4_ATOM_SAMPLE_TABLE_MAX_INDEXED_SAMPLES) return AP4_ERROR_OUT_OF_RANGE;
+
+    m_SampleChunks       = new AP4_UI32[sample_count];
+    m_SampleChunkOffsets = new AP4_UI32[sample_count];
+    m_ChunkDescriptions  = new AP4_UI32[chunk_count];
+
+    // walk the samples in order, which lets the stsc atom find each chunk
+    // from the previous one, and add up the sizes within each chunk as we go
+    AP4_Ordinal previous_chunk = 0;
+    AP4_UI64    position       = 0;
+    AP4_Size    previous_size  = 0;
+    for (AP4_Ordinal i=0; i<sample_count; i++) {
+        AP4_Ordinal chunk, skip, desc;
+        AP4_Result result = m_StscAtom->GetChunkForSample(i+1, chunk, skip, desc);
+        if (AP4_FAILED(result)) return result;
+        if (chunk == 0 || chunk > chunk_count) return AP4_ERROR_OUT_OF_RANGE;
+        if (skip == 0) {
+            position = 0;
+        } else if (chunk == previous_chunk && skip <= i) {
+            position += previous_size;
+        } else {
+            return AP4_ERROR_INVALID_FORMAT;
+        }
+        if (position > 0xFFFFFFFF) return AP4_ERROR_OUT_OF_RANGE;
+
+        AP4_Size size = 0;
+        if (m_StszAtom) {
+            result = m_StszAtom->GetSampleSize(i+1, size);
+        } else {
+            result = m_Stz2Atom->GetSampleSize(i+1, size);
+        }
+        if (AP4_FAILED(result)) return result;
+
+        m_SampleChunks[i]            = chunk;
+        m_SampleChunkOffsets[i]      = (AP4_UI32)position;
+        m_ChunkDescriptions[chunk-1] = desc;
+        previous_chunk = chunk;
+        previous_size  = size;
+    }
+    m_IndexedSampleCount = sample_count;
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_AtomSampleTable::GetSample
 +---------------------------------------------------------------------*/
@@ -100,10 +189,29 @@ AP4_AtomSampleTable::GetSample(AP4_Ordinal index,
     // MP4 uses 1-based indexes internally, so adjust by one
     index++;
 
+    // index the sample offsets the first time around
+    if (m_SampleOffsetIndexState == SAMPLE_OFFSET_INDEX_NONE) {
+        if (AP4_SUCCEEDED(BuildSampleOffsetIndex())) {
+            m_SampleOffsetIndexState = SAMPLE_OFFSET_INDEX_READY;
+        } else {
+            // the tables can't be indexed, fall back to walking the chunks
+            ResetSampleOffsetIndex();
+            m_SampleOffsetIndexState = SAMPLE_OFFSET_INDEX_UNAVAILABLE;
+        }
+    }
+
     // find out in which chunk this sample is located
     AP4_Ordinal chunk, skip, desc;
-    result = m_StscAtom->GetChunkForSample(index, chunk, skip, desc);
-    if (AP4_FAILED(result)) return result;
+    AP4_UI32    offset_in_chunk = 0;
+    if (index <= m_IndexedSampleCount) {
+        chunk           = m_SampleChunks[index-1];
+        skip            = 0;
+        desc            = m_ChunkDescriptions[chunk-1];
+        offset_in_chunk = m_SampleChunkOffsets[index-1];
+    } else {
+        result = m_StscAtom->GetChunkForSample(index, chunk, skip, desc);
+        if (AP4_FAILED(result)) return result;
+    }
     
     // check that the result is within bounds
     if (skip > index) return AP4_ERROR_INTERNAL;
@@ -118,7 +226,8 @@ AP4_AtomSampleTable::GetSample(AP4_Ordinal index,
         result = m_Co64Atom->GetChunkOffset(chunk, offset);
     }
     if (AP4_FAILED(result)) return result;
-    
+    offset += offset_in_chunk;
+
     // compute the additional offset inside the chunk
     for (unsigned int i = index-skip; i < index; i++) {
         AP4_Size size = 0;
@@ -314,6 +423,9 @@ AP4_AtomSampleTable::SetChunkOffset(AP4_Ordinal  chunk_index,
 AP4_Result 
 AP4_AtomSampleTable::SetSampleSize(AP4_Ordinal sample_index, AP4_Size size)
 {
+    // the offsets of the samples that follow in the chunk change too
+    if (m_SampleOffsetIndexState != SAMPLE_OFFSET_INDEX_NONE) ResetSampleOffsetIndex();
+
     if (m_StszAtom) {
         return m_StszAtom->SetSampleSize(sample_index+1, size);
     } else if (m_Stz2Atom) {
@@ -344,21 +456,19 @@ AP4_AtomSampleTable::GetNearestSyncSampleIndex(AP4_Ordinal sample_index, bool be
     if (m_StssAtom == NULL) return sample_index;
     
     sample_index += 1; // the table is 1-based
-    AP4_Cardinal entry_count = m_StssAtom->GetEntries().ItemCount();
+    const AP4_Array<AP4_UI32>& entries = m_StssAtom->GetEntries();
+    AP4_Ordinal entry_index = m_StssAtom->GetEntryIndexForSample(sample_index);
     if (before) {
-        AP4_Ordinal cursor = 0;    
-        for (unsigned int i=0; i<entry_count; i++) {
-            if (m_StssAtom->GetEntries()[i] >= sample_index) return cursor;
-            if (m_StssAtom->GetEntries()[i]) cursor = m_StssAtom->GetEntries()[i]-1;
+        // the last sync sample before this entry
+        while (entry_index--) {
+            if (entries[entry_index]) return entries[entry_index]-1;
         }
 
         // not found?
-        return cursor;
+        return 0;
     } else {
-        for (unsigned int i=0; i<entry_count; i++) {
-            if (m_StssAtom->GetEntries()[i] >= sample_index) {
-                return m_StssAtom->GetEntries()[i]?m_StssAtom->GetEntries()[i]-1:sample_index-1;
-            }
+        if (entry_index < entries.ItemCount()) {
+            return entries[entry_index]?entries[entry_index]-1:sample_index-1;
         }
 
         // not found?
@@ -84,6 +84,10 @@ class AP4_AtomSampleTable : public AP4_SampleTable
     virtual AP4_Result SetSampleSize(AP4_Ordinal sample_index, AP4_Size size);
 
 private:
+    // methods
+    AP4_Result BuildSampleOffsetIndex();
+    void       ResetSampleOffsetIndex();
+
     // members
     AP4_ByteStream& m_SampleStream;
     AP4_StscAtom*   m_StscAtom;
@@ -95,6 +99,19 @@ private:
     AP4_StsdAtom*   m_StsdAtom;
     AP4_StssAtom*   m_StssAtom;
     AP4_Co64Atom*   m_Co64Atom;
+
+    // sample offset index, built on the first call to GetSample so that
+    // a sample can be located without walking the other samples of its chunk
+    typedef enum {
+        SAMPLE_OFFSET_INDEX_NONE,
+        SAMPLE_OFFSET_INDEX_READY,
+        SAMPLE_OFFSET_INDEX_UNAVAILABLE
+    } SampleOffsetIndexState;
+    SampleOffsetIndexState m_SampleOffsetIndexState;
+    AP4_Cardinal           m_IndexedSampleCount;
+    AP4_UI32*              m_SampleChunks;       // 1-based chunk of each sample
+    AP4_UI32*              m_SampleChunkOffsets; // offset of each sample in its chunk
+    AP4_UI32*              m_ChunkDescriptions;  // 1-based sample description of each chunk
 };
 
 #endif // _AP4_ATOM_SAMPLE_TABLE_H_
@@ -85,6 +85,20 @@ AP4_ByteStream::Write(const void* buffer, AP4_Size bytes_to_write)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_ByteStream::WriteBuffers
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_ByteStream::WriteBuffers(const Buffer* buffers, unsigned int buffer_count)
+{
+    for (unsigned int i=0; i<buffer_count; i++) {
+        AP4_Result result = Write(buffers[i].m_Data, buffers[i].m_Size);
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_ByteStream::WriteString
 +---------------------------------------------------------------------*/
@@ -520,6 +534,16 @@ AP4_SubStream::Seek(AP4_Position position)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_SubStream::GetDirectPointer
++---------------------------------------------------------------------*/
+const AP4_UI08*
+AP4_SubStream::GetDirectPointer(AP4_Position offset, AP4_Size size)
+{
+    if (offset > m_Size || size > m_Size-offset) return NULL;
+    return m_Container.GetDirectPointer(m_Offset+offset, size);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_SubStream::AddReference
 +---------------------------------------------------------------------*/
@@ -801,6 +825,36 @@ AP4_MemoryByteStream::Seek(AP4_Position position)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_MemoryByteStream::WriteBuffers
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_MemoryByteStream::WriteBuffers(const Buffer* buffers, unsigned int buffer_count)
+{
+    // grow the buffer once for all the data (this fails harmlessly with
+    // external storage, where the writes are then truncated as usual)
+    AP4_UI64 space_needed = m_Position;
+    for (unsigned int i=0; i<buffer_count; i++) {
+        space_needed += buffers[i].m_Size;
+    }
+    if (space_needed <= 0xFFFFFFFF) {
+        m_Buffer->Reserve((AP4_Size)space_needed);
+    }
+    
+    return AP4_ByteStream::WriteBuffers(buffers, buffer_count);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MemoryByteStream::GetDirectPointer
++---------------------------------------------------------------------*/
+const AP4_UI08*
+AP4_MemoryByteStream::GetDirectPointer(AP4_Position offset, AP4_Size size)
+{
+    AP4_Size data_size = m_Buffer->GetDataSize();
+    if (offset > data_size || size > data_size-offset) return NULL;
+    return m_Buffer->GetData()+offset;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_MemoryByteStream::AddReference
 +---------------------------------------------------------------------*/
@@ -48,6 +48,12 @@ class AP4_String;
 class AP4_ByteStream : public AP4_Referenceable
 {
  public:
+    // types
+    struct Buffer {
+        const void* m_Data;
+        AP4_Size    m_Size;
+    };
+
     // methods
     virtual AP4_Result ReadPartial(void*     buffer, 
                                    AP4_Size  bytes_to_read, 
@@ -65,6 +71,8 @@ class AP4_ByteStream : public AP4_Referenceable
                                     AP4_Size    bytes_to_write, 
                                     AP4_Size&   bytes_written) = 0;
     AP4_Result Write(const void* buffer, AP4_Size bytes_to_write);
+    // writes several buffers back to back, in as few writes as the stream allows
+    virtual AP4_Result WriteBuffers(const Buffer* buffers, unsigned int buffer_count);
     AP4_Result WriteString(const char* string_buffer);
     AP4_Result WriteDouble(double value);
     AP4_Result WriteUI64(AP4_UI64 value);
@@ -77,6 +85,11 @@ class AP4_ByteStream : public AP4_Referenceable
     virtual AP4_Result GetSize(AP4_LargeSize& size) = 0;
     virtual AP4_Result CopyTo(AP4_ByteStream& stream, AP4_LargeSize size);
     virtual AP4_Result Flush() { return AP4_SUCCESS; }
+    // address of the bytes at [offset, offset+size) when the stream holds them
+    // in memory, or NULL; the stream position is not changed
+    virtual const AP4_UI08* GetDirectPointer(AP4_Position /* offset */, AP4_Size /* size */) { 
+        return NULL; 
+    }
 };
 
 /*----------------------------------------------------------------------
@@ -105,6 +118,7 @@ class AP4_SubStream : public AP4_ByteStream
         size = m_Size;
         return AP4_SUCCESS;
     }
+    const AP4_UI08* GetDirectPointer(AP4_Position offset, AP4_Size size);
 
     // AP4_Referenceable methods
     void AddReference();
@@ -144,6 +158,9 @@ class AP4_DupStream : public AP4_ByteStream
     AP4_Result GetSize(AP4_LargeSize& size) {
         return m_OriginalStream.GetSize(size);
     }
+    const AP4_UI08* GetDirectPointer(AP4_Position offset, AP4_Size size) {
+        return m_OriginalStream.GetDirectPointer(offset, size);
+    }
 
     // AP4_Referenceable methods
     void AddReference();
@@ -176,6 +193,7 @@ public:
     AP4_Result WritePartial(const void* buffer, 
                             AP4_Size    bytes_to_write, 
                             AP4_Size&   bytes_written);
+    AP4_Result WriteBuffers(const Buffer* buffers, unsigned int buffer_count);
     AP4_Result Seek(AP4_Position position);
     AP4_Result Tell(AP4_Position& position) {
         position = m_Position;
@@ -185,6 +203,7 @@ public:
         size = m_Buffer->GetDataSize();
         return AP4_SUCCESS;
     }
+    const AP4_UI08* GetDirectPointer(AP4_Position offset, AP4_Size size);
 
     // AP4_Referenceable methods
     void AddReference();
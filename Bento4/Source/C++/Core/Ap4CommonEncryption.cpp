@@ -36,6 +36,8 @@
 #include "Ap4TencAtom.h"
 #include "Ap4SencAtom.h"
 #include "Ap4FragmentSampleTable.h"
+#include "Ap4MovieFragment.h"
+#include "Ap4MoovAtom.h"
 #include "Ap4FtypAtom.h"
 #include "Ap4StsdAtom.h"
 #include "Ap4TrakAtom.h"
@@ -1870,8 +1872,12 @@ AP4_CencSingleSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
                                                  const AP4_UI16* bytes_of_cleartext_data,
                                                  const AP4_UI32* bytes_of_encrypted_data)
 {
+    // when the input and output are the same buffer, the sample is decrypted
+    // in place and the clear ranges are left untouched
+    bool in_place = (&data_in == &data_out);
+
     // the output has the same size as the input
-    data_out.SetDataSize(data_in.GetDataSize());
+    if (!in_place) data_out.SetDataSize(data_in.GetDataSize());
 
     // check input parameters
     if (iv == NULL) return AP4_ERROR_INVALID_PARAMETERS;
@@ -1883,7 +1889,9 @@ AP4_CencSingleSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
     
     // shortcut for NULL ciphers
     if (m_Cipher == NULL) {
-        AP4_CopyMemory(data_out.UseData(), data_in.GetData(), data_in.GetDataSize());
+        if (!in_place) {
+            AP4_CopyMemory(data_out.UseData(), data_in.GetData(), data_in.GetDataSize());
+        }
         return AP4_SUCCESS;
     }
     
@@ -1907,7 +1915,7 @@ AP4_CencSingleSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
             }
 
             // copy the cleartext portion
-            if (cleartext_size) {
+            if (cleartext_size && !in_place) {
                 AP4_CopyMemory(out, in, cleartext_size);
             }
             
@@ -1928,7 +1936,7 @@ AP4_CencSingleSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
 
         // copy any leftover partial block
         unsigned int partial = (unsigned int)(in_end-in);
-        if (partial) {
+        if (partial && !in_place) {
             AP4_CopyMemory(out, in, partial);
         }
     } else {
@@ -1945,7 +1953,7 @@ AP4_CencSingleSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
             
             // any partial block at the end remains in the clear
             unsigned int partial = data_in.GetDataSize()%16;
-            if (partial) {
+            if (partial && !in_place) {
                 AP4_CopyMemory(out, in, partial);
             }        
         } else {
@@ -2089,6 +2097,13 @@ AP4_CencSampleDecrypter::Create(AP4_CencSampleInfoTable*  sample_info_table,
 
     // create the decrypter
     decrypter = new AP4_CencSampleDecrypter(single_sample_decrypter, sample_info_table);
+    
+    // remember the parameters, so that more single-sample decrypters can be created
+    decrypter->m_CipherType                     = cipher_type;
+    decrypter->m_BlockCipherFactory             = block_cipher_factory;
+    decrypter->m_ResetIvAtEachSubsample         = reset_iv_at_each_subsample;
+    decrypter->m_CanCreateSingleSampleDecrypter = true;
+    decrypter->m_Key.SetData(key, key_size);
 
     return AP4_SUCCESS;
 }
@@ -2123,10 +2138,42 @@ AP4_CencSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
     // increment the sample cursor
     unsigned int sample_cursor = m_SampleCursor++;
 
+    return DecryptSampleData(sample_cursor, *m_SingleSampleDecrypter, data_in, data_out, iv);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencSampleDecrypter::CreateSingleSampleDecrypter
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencSampleDecrypter::CreateSingleSampleDecrypter(AP4_CencSingleSampleDecrypter*& decrypter)
+{
+    decrypter = NULL;
+    if (!m_CanCreateSingleSampleDecrypter) return AP4_ERROR_INVALID_STATE;
+    
+    return AP4_CencSingleSampleDecrypter::Create(m_CipherType,
+                                                 m_Key.GetData(),
+                                                 m_Key.GetDataSize(),
+                                                 m_SampleInfoTable->GetCryptByteBlock(),
+                                                 m_SampleInfoTable->GetSkipByteBlock(),
+                                                 m_BlockCipherFactory,
+                                                 m_ResetIvAtEachSubsample,
+                                                 decrypter);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencSampleDecrypter::DecryptSampleData
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencSampleDecrypter::DecryptSampleData(AP4_Ordinal                    sample_index,
+                                           AP4_CencSingleSampleDecrypter& decrypter,
+                                           AP4_DataBuffer&                data_in,
+                                           AP4_DataBuffer&                data_out,
+                                           const AP4_UI08*                iv)
+{
     // setup the IV
     unsigned char iv_block[16];
     if (iv == NULL) {
-        iv = m_SampleInfoTable->GetIv(sample_cursor);
+        iv = m_SampleInfoTable->GetIv(sample_index);
     }
     if (iv == NULL) return AP4_ERROR_INVALID_FORMAT;
     unsigned int iv_size = m_SampleInfoTable->GetIvSize();
@@ -2138,12 +2185,86 @@ AP4_CencSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
     const AP4_UI16* bytes_of_cleartext_data = NULL;
     const AP4_UI32* bytes_of_encrypted_data = NULL;
     if (m_SampleInfoTable) {
-        AP4_Result result = m_SampleInfoTable->GetSampleInfo(sample_cursor, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
+        AP4_Result result = m_SampleInfoTable->GetSampleInfo(sample_index, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
         if (AP4_FAILED(result)) return result;
     }
     
     // decrypt the sample
-    return m_SingleSampleDecrypter->DecryptSampleData(data_in, data_out, iv_block, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
+    return decrypter.DecryptSampleData(data_in, data_out, iv_block, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencSampleDecrypter::CheckSampleData
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencSampleDecrypter::CheckSampleData(AP4_Ordinal sample_index, AP4_Size sample_size)
+{
+    // the same checks as when decrypting the sample
+    if (m_SampleInfoTable == NULL) return AP4_SUCCESS;
+    if (m_SampleInfoTable->GetIv(sample_index) == NULL) return AP4_ERROR_INVALID_FORMAT;
+    unsigned int    subsample_count = 0;
+    const AP4_UI16* bytes_of_cleartext_data = NULL;
+    const AP4_UI32* bytes_of_encrypted_data = NULL;
+    AP4_Result result = m_SampleInfoTable->GetSampleInfo(sample_index, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
+    if (AP4_FAILED(result)) return result;
+    if (subsample_count && (bytes_of_cleartext_data == NULL || bytes_of_encrypted_data == NULL)) {
+        return AP4_ERROR_INVALID_PARAMETERS;
+    }
+    AP4_UI64 subsamples_size = 0;
+    for (unsigned int i=0; i<subsample_count; i++) {
+        subsamples_size += bytes_of_cleartext_data[i]+(AP4_UI64)bytes_of_encrypted_data[i];
+    }
+    
+    return subsamples_size <= sample_size ? AP4_SUCCESS : AP4_ERROR_INVALID_FORMAT;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencLocateAtom
++---------------------------------------------------------------------*/
+static AP4_UI08*
+AP4_CencLocateAtom(AP4_Atom* atom, AP4_Atom* top, AP4_UI08* top_data)
+{
+    if (atom == top) return top_data;
+    
+    // locate the parent first
+    AP4_AtomParent* parent = atom->GetParent();
+    AP4_Atom* parent_atom = AP4_DYNAMIC_CAST(AP4_Atom, parent);
+    if (parent_atom == NULL) return NULL;
+    AP4_UI08* parent_data = AP4_CencLocateAtom(parent_atom, top, top_data);
+    if (parent_data == NULL) return NULL;
+
+    // the children of an atom are stored back to back, at the end of the atom
+    AP4_LargeSize tail_size = 0;
+    for (AP4_List<AP4_Atom>::Item* item = parent->GetChildren().LastItem();
+                                   item;
+                                   item = item->GetPrev()) {
+        tail_size += item->GetData()->GetSize();
+        if (item->GetData() == atom) break;
+    }
+    if (tail_size > parent_atom->GetSize()) return NULL;
+    AP4_UI08* data = parent_data+parent_atom->GetSize()-tail_size;
+    
+    // check that the atom is really there
+    if (AP4_BytesToUInt32BE(data+4) != atom->GetType()) return NULL;
+    
+    return data;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencSetAtomTypeInPlace
++---------------------------------------------------------------------*/
+static AP4_Result
+AP4_CencSetAtomTypeInPlace(AP4_Atom*      atom, 
+                           AP4_Atom::Type type, 
+                           AP4_Atom*      top, 
+                           AP4_UI08*      top_data,
+                           bool           check_only)
+{
+    AP4_UI08* data = AP4_CencLocateAtom(atom, top, top_data);
+    if (data == NULL) return AP4_ERROR_INVALID_FORMAT;
+    if (!check_only) AP4_BytesFromUInt32BE(data+4, type);
+    
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -2164,6 +2285,7 @@ public:
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
     virtual AP4_Result ProcessTrack();
+    AP4_Result         ProcessTrackInPlace(AP4_Atom* moov, AP4_UI08* moov_data, bool check_only);
 
     // accessors
     AP4_ProtectedSampleDescription* GetSampleDescription(unsigned int i) {
@@ -2255,6 +2377,26 @@ AP4_CencTrackDecrypter::ProcessTrack()
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CencTrackDecrypter::ProcessTrackInPlace
++---------------------------------------------------------------------*/
+AP4_Result   
+AP4_CencTrackDecrypter::ProcessTrackInPlace(AP4_Atom* moov, AP4_UI08* moov_data, bool check_only)
+{
+    for (unsigned int i=0; i<m_SampleEntries.ItemCount(); i++) {
+        // turn the 'sinf' atom into a 'free' atom (this has to be done before
+        // the sample entry type changes, because its location is checked)
+        AP4_Atom* sinf = m_SampleEntries[i]->GetChild(AP4_ATOM_TYPE_SINF);
+        if (sinf) {
+            AP4_Result result = AP4_CencSetAtomTypeInPlace(sinf, AP4_ATOM_TYPE_FREE, moov, moov_data, check_only);
+            if (AP4_FAILED(result)) return result;
+        }
+        AP4_Result result = AP4_CencSetAtomTypeInPlace(m_SampleEntries[i], m_OriginalFormat, moov, moov_data, check_only);
+        if (AP4_FAILED(result)) return result;
+    }
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencFragmentDecrypter
 +---------------------------------------------------------------------*/
@@ -2277,6 +2419,18 @@ public:
     virtual AP4_Result FinishFragment();
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual bool       CanProcessSampleInPlace() { return true; }
+    virtual bool       CanProcessSamplesInParallel() {
+        return m_SampleDecrypter && m_SampleDecrypter->CanCreateSingleSampleDecrypter();
+    }
+    virtual AP4_Result ProcessSamples(AP4_Ordinal     first,
+                                      AP4_Cardinal    count,
+                                      AP4_DataBuffer* samples_in,
+                                      AP4_DataBuffer* samples_out);
+    AP4_Result         ProcessFragmentInPlace(AP4_Atom* moof, AP4_UI08* moof_data, bool check_only);
+    AP4_Result         CheckSample(AP4_Ordinal sample_index, AP4_Size sample_size) {
+        return m_SampleDecrypter->CheckSampleData(sample_index, sample_size);
+    }
 
 private:
     // members
@@ -2302,6 +2456,27 @@ AP4_CencFragmentDecrypter::ProcessFragment()
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentDecrypter::ProcessFragmentInPlace
++---------------------------------------------------------------------*/
+AP4_Result   
+AP4_CencFragmentDecrypter::ProcessFragmentInPlace(AP4_Atom* moof, AP4_UI08* moof_data, bool check_only)
+{
+    // turn the sample encryption atoms into 'free' atoms
+    AP4_Atom* atoms[3] = {
+        m_SaioAtom,
+        m_SaizAtom,
+        m_SampleEncryptionAtom ? &m_SampleEncryptionAtom->GetOuter() : NULL
+    };
+    for (unsigned int i=0; i<3; i++) {
+        if (atoms[i] == NULL) continue;
+        AP4_Result result = AP4_CencSetAtomTypeInPlace(atoms[i], AP4_ATOM_TYPE_FREE, moof, moof_data, check_only);
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencFragmentDecrypter::FinishFragment
 +---------------------------------------------------------------------*/
@@ -2330,6 +2505,30 @@ AP4_CencFragmentDecrypter::ProcessSample(AP4_DataBuffer& data_in,
     return m_SampleDecrypter->DecryptSampleData(data_in, data_out, NULL);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentDecrypter::ProcessSamples
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencFragmentDecrypter::ProcessSamples(AP4_Ordinal     first,
+                                          AP4_Cardinal    count,
+                                          AP4_DataBuffer* samples_in,
+                                          AP4_DataBuffer* samples_out)
+{
+    // this may run concurrently with other ranges, so use a separate cipher
+    AP4_CencSingleSampleDecrypter* decrypter = NULL;
+    AP4_Result result = m_SampleDecrypter->CreateSingleSampleDecrypter(decrypter);
+    if (AP4_FAILED(result)) return result;
+    
+    // decrypt the samples, in place if the arrays are the same
+    for (unsigned int i=first; i<first+count; i++) {
+        result = m_SampleDecrypter->DecryptSampleData(i, *decrypter, samples_in[i], samples_out[i]);
+        if (AP4_FAILED(result)) break;
+    }
+    delete decrypter;
+    
+    return result;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencDecryptingProcessor::AP4_CencDecryptingProcessor
 +---------------------------------------------------------------------*/
@@ -2489,6 +2688,179 @@ AP4_CencDecryptingProcessor::CreateFragmentHandler(AP4_TrakAtom*      trak,
     
     return new AP4_CencFragmentDecrypter(sample_decrypter, saio, saiz, sample_encryption_atom);
 }
+
+/*----------------------------------------------------------------------
+|   AP4_CencDecryptingProcessor::ProcessFragmentInPlace
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_CencDecryptingProcessor::ProcessFragmentInPlace(AP4_MoovAtom*      moov,
+                                                    AP4_ContainerAtom* moof,
+                                                    AP4_ByteStream&    stream,
+                                                    AP4_Position       moof_offset,
+                                                    AP4_UI08*          data,
+                                                    AP4_Size           data_size,
+                                                    bool               check_only)
+{
+    AP4_UI64           mdat_payload_offset = moof_offset+moof->GetSize()+AP4_ATOM_HEADER_SIZE;
+    AP4_ContainerAtom* mvex = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moov->GetChild(AP4_ATOM_TYPE_MVEX));
+    AP4_Sample         sample;
+    AP4_DataBuffer     sample_data;
+    
+    for (unsigned int i=0;; i++) {
+        AP4_ContainerAtom* traf = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moof->GetChild(AP4_ATOM_TYPE_TRAF, i));
+        if (traf == NULL) break;
+        AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
+        if (tfhd == NULL) return AP4_ERROR_INVALID_FORMAT;
+        
+        // find the 'trak' and the 'trex' for this track
+        AP4_TrakAtom* trak = NULL;
+        for (AP4_List<AP4_TrakAtom>::Item* item = moov->GetTrakAtoms().FirstItem();
+                                           item;
+                                           item = item->GetNext()) {
+            if (item->GetData()->GetId() == tfhd->GetTrackId()) {
+                trak = item->GetData();
+                break;
+            }
+        }
+        AP4_TrexAtom* trex = NULL;
+        for (unsigned int j=0; mvex; j++) {
+            trex = AP4_DYNAMIC_CAST(AP4_TrexAtom, mvex->GetChild(AP4_ATOM_TYPE_TREX, j));
+            if (trex == NULL || trex->GetTrackId() == tfhd->GetTrackId()) break;
+        }
+        if (trak == NULL || trex == NULL) return AP4_ERROR_INVALID_FORMAT;
+        
+        // create the decrypter for this traf (NULL for tracks in the clear)
+        AP4_CencFragmentDecrypter* decrypter = static_cast<AP4_CencFragmentDecrypter*>(
+            AP4_CencDecryptingProcessor::CreateFragmentHandler(trak, trex, traf, stream, moof_offset));
+        if (decrypter == NULL) continue;
+
+        // decrypt the samples where they are, or only check that they can be
+        AP4_FragmentSampleTable sample_table(traf, trex, &stream, moof_offset, mdat_payload_offset);
+        AP4_Result result = AP4_SUCCESS;
+        for (unsigned int j=0; AP4_SUCCEEDED(result) && j<sample_table.GetSampleCount(); j++) {
+            result = sample_table.GetSample(j, sample);
+            if (AP4_FAILED(result)) break;
+            if (sample.GetOffset() > data_size || sample.GetSize() > data_size-sample.GetOffset()) {
+                result = AP4_ERROR_INVALID_FORMAT;
+                break;
+            }
+            if (check_only) {
+                result = decrypter->CheckSample(j, sample.GetSize());
+                continue;
+            }
+            sample_data.SetBuffer(data+sample.GetOffset(), sample.GetSize());
+            sample_data.SetDataSize(sample.GetSize());
+            result = decrypter->ProcessSample(sample_data, sample_data);
+        }
+        
+        // neutralize the sample encryption atoms
+        if (AP4_SUCCEEDED(result)) {
+            result = decrypter->ProcessFragmentInPlace(moof, data+moof_offset, check_only);
+        }
+        delete decrypter;
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencDecryptingProcessor::ProcessInPlace
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_CencDecryptingProcessor::ProcessInPlace(AP4_UI08*        data,
+                                            AP4_Size         data_size,
+                                            AP4_AtomFactory& atom_factory)
+{
+    // read the atoms directly from the buffer
+    AP4_DataBuffer buffer;
+    buffer.SetBuffer(data, data_size);
+    buffer.SetDataSize(data_size);
+    AP4_MemoryByteStream* stream = new AP4_MemoryByteStream(buffer);
+
+    // use the init data if it has been loaded, otherwise the 'moov' has to
+    // be in the buffer
+    AP4_MoovAtom* moov        = m_InitMoov;
+    AP4_Position  moov_offset = 0;
+    AP4_Result    result      = AP4_SUCCESS;
+    if (moov && moov->GetChild(AP4_ATOM_TYPE_MVEX) == NULL) {
+        stream->Release();
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+    if (moov == NULL) {
+        m_TrackIds.Clear();
+        m_TrackHandlers.Clear();
+    }
+    
+    // go through the buffer twice: first only check that everything can be
+    // decrypted, so that nothing is changed when something can't, then
+    // decrypt it
+    for (unsigned int pass=0; pass<2 && AP4_SUCCEEDED(result); pass++) {
+        bool         check_only = (pass == 0);
+        AP4_Position offset     = 0;
+        stream->Seek(0);
+        for (AP4_Atom* atom = NULL;
+             AP4_SUCCEEDED(result) && AP4_SUCCEEDED(atom_factory.CreateAtomFromStream(*stream, atom));
+             stream->Tell(offset)) {
+            if (atom->GetType() == AP4_ATOM_TYPE_MOOV && moov == NULL) {
+                moov        = AP4_DYNAMIC_CAST(AP4_MoovAtom, atom);
+                moov_offset = offset;
+                
+                // the samples of a non-fragmented file are not described by
+                // fragments, so there would be nothing to decrypt
+                if (moov->GetChild(AP4_ATOM_TYPE_MVEX) == NULL) {
+                    result = AP4_ERROR_NOT_SUPPORTED;
+                    continue;
+                }
+
+                // create the track handlers
+                for (AP4_List<AP4_TrakAtom>::Item* item = moov->GetTrakAtoms().FirstItem();
+                                                   item;
+                                                   item = item->GetNext()) {
+                    AP4_TrakAtom* trak = item->GetData();
+                    m_TrackIds.Append(trak->GetId());
+                    m_TrackHandlers.Append(CreateTrackHandler(trak));
+                }
+            } else if (atom->GetType() == AP4_ATOM_TYPE_MOOV && moov != m_InitMoov && offset == moov_offset) {
+                // the 'moov' parsed in the first pass is the one that is used
+                delete atom;
+            } else {
+                if (atom->GetType() == AP4_ATOM_TYPE_MOOF && moov) {
+                    AP4_ContainerAtom* moof = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
+                    if (moof) {
+                        result = ProcessFragmentInPlace(moov, moof, *stream, offset, data, data_size, check_only);
+                    }
+                } else if (atom->GetType() == AP4_ATOM_TYPE_MOOF) {
+                    // a fragment without a 'moov' to describe it
+                    result = AP4_ERROR_INVALID_FORMAT;
+                }
+                delete atom;
+                continue;
+            }
+            
+            // restore the sample entries
+            for (unsigned int i=0; i<m_TrackHandlers.ItemCount() && AP4_SUCCEEDED(result); i++) {
+                AP4_CencTrackDecrypter* track_decrypter = AP4_DYNAMIC_CAST(AP4_CencTrackDecrypter, m_TrackHandlers[i]);
+                if (track_decrypter) {
+                    result = track_decrypter->ProcessTrackInPlace(moov, data+moov_offset, check_only);
+                }
+            }
+        }
+    }
+    
+    // cleanup
+    if (moov != m_InitMoov) {
+        for (unsigned int i=0; i<m_TrackHandlers.ItemCount(); i++) {
+            delete m_TrackHandlers[i];
+        }
+        m_TrackHandlers.Clear();
+        m_TrackIds.Clear();
+        delete moov;
+    }
+    stream->Release();
+    
+    return result;
+}
     
 /*----------------------------------------------------------------------
 |   AP4_CencTrackEncryption Dynamic Cast Anchor
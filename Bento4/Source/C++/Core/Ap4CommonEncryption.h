@@ -46,6 +46,7 @@ class AP4_StreamCipher;
 class AP4_SaizAtom;
 class AP4_SaioAtom;
 class AP4_CencSampleInfoTable;
+class AP4_MoovAtom;
 class AP4_AvcFrameParser;
 class AP4_HevcFrameParser;
 
@@ -663,10 +664,34 @@ public:
                                                                   AP4_ContainerAtom* traf,
                                                                   AP4_ByteStream&    moof_data,
                                                                   AP4_Position       moof_offset);
+
+    /**
+     * Decrypt fragmented content in place, in a memory buffer.
+     * The sample data is decrypted where it lies, the protected sample
+     * entries get their original format back, and the 'sinf', 'senc', 
+     * 'saio' and 'saiz' atoms are turned into 'free' atoms, so that no
+     * atom is moved or resized. Unless init data has been loaded with
+     * LoadInit(), the 'moov' atom must come before the fragments in the
+     * buffer. Non-fragmented content (a 'moov' without an 'mvex' atom)
+     * can't be decrypted in place: AP4_ERROR_NOT_SUPPORTED is returned.
+     * The whole buffer is checked before anything is changed, so when
+     * an error is returned, the buffer is left untouched.
+     */
+    AP4_Result ProcessInPlace(AP4_UI08*        data,
+                              AP4_Size         data_size,
+                              AP4_AtomFactory& atom_factory = 
+                                  AP4_DefaultAtomFactory::Instance_);
     
 protected:
     // methods
     const AP4_DataBuffer* GetKeyForTrak(AP4_UI32 track_id, AP4_ProtectedSampleDescription* sample_description);
+    AP4_Result            ProcessFragmentInPlace(AP4_MoovAtom*      moov,
+                                                 AP4_ContainerAtom* moof,
+                                                 AP4_ByteStream&    stream,
+                                                 AP4_Position       moof_offset,
+                                                 AP4_UI08*          data,
+                                                 AP4_Size           data_size,
+                                                 bool               check_only);
 
     // members
     AP4_BlockCipherFactory*     m_BlockCipherFactory;
@@ -693,6 +718,12 @@ public:
         m_Cipher(cipher),
         m_FullBlocksOnly(false) {}
     virtual ~AP4_CencSingleSampleDecrypter();
+
+    /**
+     * Decrypt the data of one sample.
+     * data_in and data_out may be the same buffer, in which case the sample
+     * is decrypted in place and the clear ranges are not copied.
+     */
     virtual AP4_Result DecryptSampleData(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out,
                                          
@@ -763,17 +794,56 @@ public:
                             AP4_CencSampleInfoTable*       sample_info_table) :
         m_SingleSampleDecrypter(single_sample_decrypter),
         m_SampleInfoTable(sample_info_table),
-        m_SampleCursor(0) {}
+        m_SampleCursor(0),
+        m_CipherType(AP4_CENC_CIPHER_NONE),
+        m_BlockCipherFactory(NULL),
+        m_ResetIvAtEachSubsample(false),
+        m_CanCreateSingleSampleDecrypter(false) {}
     virtual ~AP4_CencSampleDecrypter();
     virtual AP4_Result SetSampleIndex(AP4_Ordinal sample_index);
     virtual AP4_Result DecryptSampleData(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out,
                                          const AP4_UI08* iv);
     
+    /**
+     * Create a new single-sample decrypter, with its own cipher state,
+     * for use with the indexed DecryptSampleData() method below.
+     * This is only possible if this decrypter was created from a 
+     * sample info table and a key.
+     */
+    AP4_Result CreateSingleSampleDecrypter(AP4_CencSingleSampleDecrypter*& decrypter);
+    bool       CanCreateSingleSampleDecrypter() { return m_CanCreateSingleSampleDecrypter; }
+
+    /**
+     * Decrypt the data of the sample with a given index, using a 
+     * single-sample decrypter obtained from CreateSingleSampleDecrypter().
+     * This does not use or change the sample cursor, so different samples
+     * may be decrypted concurrently, as long as each thread uses its own
+     * single-sample decrypter.
+     */
+    AP4_Result DecryptSampleData(AP4_Ordinal                    sample_index,
+                                 AP4_CencSingleSampleDecrypter& decrypter,
+                                 AP4_DataBuffer&                data_in,
+                                 AP4_DataBuffer&                data_out,
+                                 const AP4_UI08*                iv = NULL);
+
+    /**
+     * Check that the data of the sample with a given index, and of a
+     * given size, can be decrypted: its IV and subsample information
+     * are there, and the subsamples fit in the sample. Nothing is
+     * decrypted, and the sample cursor is not changed.
+     */
+    AP4_Result CheckSampleData(AP4_Ordinal sample_index, AP4_Size sample_size);
+    
 protected:
     AP4_CencSingleSampleDecrypter* m_SingleSampleDecrypter;
     AP4_CencSampleInfoTable*       m_SampleInfoTable;
     AP4_Ordinal                    m_SampleCursor;
+    AP4_UI32                       m_CipherType;
+    AP4_DataBuffer                 m_Key;
+    AP4_BlockCipherFactory*        m_BlockCipherFactory;
+    bool                           m_ResetIvAtEachSubsample;
+    bool                           m_CanCreateSingleSampleDecrypter;
 };
 
 /*----------------------------------------------------------------------
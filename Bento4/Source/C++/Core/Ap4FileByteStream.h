@@ -82,10 +82,16 @@ public:
                             AP4_Size&   bytesWritten) {
         return m_Delegate->WritePartial(buffer, bytesToWrite, bytesWritten);
     }
+    AP4_Result WriteBuffers(const Buffer* buffers, unsigned int bufferCount) {
+        return m_Delegate->WriteBuffers(buffers, bufferCount);
+    }
     AP4_Result Seek(AP4_Position position)  { return m_Delegate->Seek(position); }
     AP4_Result Tell(AP4_Position& position) { return m_Delegate->Tell(position); }
     AP4_Result GetSize(AP4_LargeSize& size) { return m_Delegate->GetSize(size);  }
     AP4_Result Flush()                      { return m_Delegate->Flush();        }
+    const AP4_UI08* GetDirectPointer(AP4_Position offset, AP4_Size size) {
+        return m_Delegate->GetDirectPointer(offset, size);
+    }
 
     // AP4_Referenceable methods
     void AddReference() { m_Delegate->AddReference(); }
@@ -101,6 +107,35 @@ protected:
     AP4_ByteStream* m_Delegate;
 };
 
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream
++---------------------------------------------------------------------*/
+class AP4_MmapFileByteStream
+{
+public:
+    // types
+    typedef enum {
+        ACCESS_NORMAL     = 0,
+        ACCESS_SEQUENTIAL = 1,
+        ACCESS_RANDOM     = 2
+    } Access;
+
+    /**
+     * Create a read-only stream from a regular file mapped in memory.
+     * Reads are served from the mapping instead of going through stdio.
+     *
+     * @param name Name of the file to open
+     * @param access Expected access pattern, passed on to the kernel as a hint
+     * @param stream Reference to a pointer where the stream object will
+     * be returned
+     * @return AP4_SUCCESS if the file can be mapped, AP4_ERROR_NOT_SUPPORTED
+     * if it is not a regular file or the platform does not support mapping,
+     * or another error code if it cannot be opened. Callers would typically
+     * fall back to AP4_FileByteStream::Create when this fails.
+     */
+    static AP4_Result Create(const char* name, Access access, AP4_ByteStream*& stream);
+};
+
 #endif // _AP4_FILE_BYTE_STREAM_H_
 
 
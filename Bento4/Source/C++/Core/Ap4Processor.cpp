@@ -77,6 +77,39 @@ struct AP4_AtomLocator {
     AP4_UI64  m_Offset;
 };
 
+/*----------------------------------------------------------------------
+|   AP4_PhaseTimer
++---------------------------------------------------------------------*/
+class AP4_PhaseTimer {
+public:
+    AP4_PhaseTimer(AP4_Processor::Instrumentation* instrumentation) :
+        m_Instrumentation(instrumentation),
+        m_Start(0) {
+        Restart();
+    }
+
+    // start timing a phase
+    void Restart() {
+        if (m_Instrumentation) m_Start = m_Instrumentation->GetTime();
+    }
+
+    // report the time since the last call to Restart() or Report(),
+    // so that consecutive phases can be reported back to back
+    void Report(AP4_Processor::Instrumentation::Phase phase,
+                AP4_UI32                              track_id,
+                AP4_UI64                              bytes,
+                AP4_Cardinal                          samples) {
+        if (m_Instrumentation == NULL) return;
+        AP4_UI64 now = m_Instrumentation->GetTime();
+        m_Instrumentation->OnPhase(phase, track_id, now-m_Start, bytes, samples);
+        m_Start = now;
+    }
+
+private:
+    AP4_Processor::Instrumentation* m_Instrumentation;
+    AP4_UI64                        m_Start;
+};
+
 /*----------------------------------------------------------------------
 |   AP4_DefaultFragmentHandler
 +---------------------------------------------------------------------*/
@@ -104,6 +137,89 @@ AP4_DefaultFragmentHandler::ProcessSample(AP4_DataBuffer& data_in, AP4_DataBuffe
     return m_TrackHandler->ProcessSample(data_in, data_out);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_FragmentSamplesJob
++---------------------------------------------------------------------*/
+class AP4_FragmentSamplesJob : public AP4_Processor::ParallelRunner::Job {
+public:
+    AP4_FragmentSamplesJob(AP4_Processor::FragmentHandler& handler,
+                           AP4_DataBuffer*                 samples_in,
+                           AP4_DataBuffer*                 samples_out) :
+        m_Handler(handler),
+        m_SamplesIn(samples_in),
+        m_SamplesOut(samples_out) {}
+    AP4_Result Run(AP4_Ordinal first, AP4_Cardinal count) {
+        return m_Handler.ProcessSamples(first, count, m_SamplesIn, m_SamplesOut);
+    }
+
+private:
+    AP4_Processor::FragmentHandler& m_Handler;
+    AP4_DataBuffer*                 m_SamplesIn;
+    AP4_DataBuffer*                 m_SamplesOut;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_ProcessSamplesInParallel
++---------------------------------------------------------------------*/
+static AP4_Result
+AP4_ProcessSamplesInParallel(AP4_Processor::ParallelRunner&  runner,
+                             AP4_Processor::FragmentHandler& handler,
+                             AP4_FragmentSampleTable&        sample_table,
+                             AP4_DataBuffer&                 data,
+                             AP4_Array<AP4_DataBuffer>&      samples_in,
+                             AP4_Array<AP4_DataBuffer>&      samples_out,
+                             AP4_PhaseTimer&                 timer,
+                             AP4_UI32                        track_id)
+{
+    AP4_Cardinal sample_count = sample_table.GetSampleCount();
+    AP4_Sample   sample;
+    AP4_Result   result;
+
+    timer.Restart();
+
+    // compute the total size of the samples, and refer to the input data
+    // where it is if possible
+    result = samples_in.SetItemCount(sample_count);
+    if (AP4_FAILED(result)) return result;
+    result = samples_out.SetItemCount(sample_count);
+    if (AP4_FAILED(result)) return result;
+    AP4_Size data_size = 0;
+    bool     in_place  = false;
+    for (unsigned int i=0; i<sample_count; i++) {
+        result = sample_table.GetSample(i, sample);
+        if (AP4_FAILED(result)) return result;
+        data_size += sample.GetSize();
+        if (!in_place && AP4_FAILED(sample.ReadDataView(samples_in[i]))) {
+            in_place = true;
+        }
+    }
+    
+    // lay the processed samples out back to back, in a single buffer, or
+    // else read them there, to be processed in place
+    result = data.SetDataSize(data_size);
+    if (AP4_FAILED(result)) return result;
+    AP4_UI08* sample_data = data.UseData();
+    for (unsigned int i=0; i<sample_count; i++) {
+        result = sample_table.GetSample(i, sample);
+        if (AP4_FAILED(result)) return result;
+        samples_out[i].SetBuffer(sample_data, sample.GetSize());
+        if (in_place) {
+            result = sample.ReadData(samples_out[i]);
+            if (AP4_FAILED(result)) return result;
+        }
+        sample_data += sample.GetSize();
+    }
+    timer.Report(AP4_Processor::Instrumentation::PHASE_READ, track_id, data_size, sample_count);
+    if (sample_count == 0) return AP4_SUCCESS;
+
+    // process the samples into their place
+    AP4_FragmentSamplesJob job(handler, in_place ? &samples_out[0] : &samples_in[0], &samples_out[0]);
+    result = runner.Run(job, sample_count);
+    timer.Report(AP4_Processor::Instrumentation::PHASE_PROCESS, track_id, data_size, sample_count);
+
+    return result;
+}
+
 /*----------------------------------------------------------------------
 |   FragmentMapEntry
 +---------------------------------------------------------------------*/
@@ -148,6 +264,18 @@ AP4_Processor::ProcessFragments(AP4_MoovAtom*              moov,
 {
     unsigned int fragment_index = 0;
     AP4_Array<FragmentMapEntry> fragment_map;
+    AP4_PhaseTimer timer(m_Instrumentation);
+    AP4_DataBuffer fragment_header;
+    
+    // the processed samples are kept until their fragment is written, in
+    // buffers reused from one fragment to the next: one per sample for the
+    // samples processed one by one, one per track for the samples processed
+    // in parallel
+    AP4_Array<AP4_DataBuffer>         sample_buffers;
+    AP4_Array<AP4_DataBuffer>         track_buffers;
+    AP4_Array<AP4_DataBuffer>         parallel_samples_in;
+    AP4_Array<AP4_DataBuffer>         parallel_samples_out;
+    AP4_Array<AP4_ByteStream::Buffer> fragment_buffers;
     
     for (AP4_List<AP4_AtomLocator>::Item* item = atoms.FirstItem();
                                           item;
@@ -158,12 +286,15 @@ AP4_Processor::ProcessFragments(AP4_MoovAtom*              moov,
         AP4_UI64           mdat_payload_offset = atom_offset+atom->GetSize()+AP4_ATOM_HEADER_SIZE;
         AP4_Sample         sample;
         AP4_DataBuffer     sample_data_in;
-        AP4_DataBuffer     sample_data_out;
+        AP4_DataBuffer     sample_data_view;
         AP4_Result         result;
     
         // if this is not a moof atom, just write it back and continue
         if (atom->GetType() != AP4_ATOM_TYPE_MOOF) {
+            timer.Restart();
             result = atom->Write(output);
+            timer.Report(Instrumentation::PHASE_WRITE, 0, atom->GetSize(), 0);
+            delete atom;
             if (AP4_FAILED(result)) return result;
             continue;
         }
@@ -226,8 +357,10 @@ AP4_Processor::ProcessFragments(AP4_MoovAtom*              moov,
             
             // create a sample table object so we can read the sample data
             AP4_FragmentSampleTable* sample_table = NULL;
+            timer.Restart();
             result = fragment->CreateSampleTable(moov, tfhd->GetTrackId(), &input, atom_offset, mdat_payload_offset, 0, sample_table);
             if (AP4_FAILED(result)) return result;
+            timer.Report(Instrumentation::PHASE_SAMPLE_TABLE, tfhd->GetTrackId(), traf->GetSize(), sample_table->GetSampleCount());
             sample_tables.Append(sample_table);
             
             // let the handler look at the samples before we process them
@@ -235,22 +368,38 @@ AP4_Processor::ProcessFragments(AP4_MoovAtom*              moov,
             if (AP4_FAILED(result)) return result;
         }
              
-        // write the moof
-        AP4_UI64 moof_out_start = 0;
+        // the size of the moof does not change from here on, so the fragment
+        // can be laid out now, and written in one go once the samples are
+        // processed, without seeking back to update the headers
+        AP4_Position moof_out_start = 0;
         output.Tell(moof_out_start);
-        moof->Write(output);
+        AP4_Position mdat_out_start = moof_out_start+moof->GetSize();
+        AP4_UI64     mdat_size = AP4_ATOM_HEADER_SIZE;
+        
+        // make room for the samples of this fragment, so that the buffers
+        // don't move once they are listed for the write (the first one
+        // listed is the header, serialized last)
+        AP4_Cardinal fragment_sample_count = 0;
+        for (unsigned int i=0; i<sample_tables.ItemCount(); i++) {
+            fragment_sample_count += sample_tables[i]->GetSampleCount();
+        }
+        if (sample_buffers.ItemCount() < fragment_sample_count) {
+            result = sample_buffers.SetItemCount(fragment_sample_count);
+            if (AP4_FAILED(result)) return result;
+        }
+        if (track_buffers.ItemCount() < handlers.ItemCount()) {
+            result = track_buffers.SetItemCount(handlers.ItemCount());
+            if (AP4_FAILED(result)) return result;
+        }
+        result = fragment_buffers.EnsureCapacity(fragment_sample_count+handlers.ItemCount()+1);
+        if (AP4_FAILED(result)) return result;
+        fragment_buffers.SetItemCount(1);
+        AP4_Ordinal sample_buffer_index = 0;
         
         // remember the location of this fragment
         FragmentMapEntry map_entry = {atom_offset, moof_out_start};
         fragment_map.Append(map_entry);
 
-        // write an mdat header
-        AP4_Position mdat_out_start;
-        AP4_UI64 mdat_size = AP4_ATOM_HEADER_SIZE;
-        output.Tell(mdat_out_start);
-        output.WriteUI32(0);
-        output.WriteUI32(AP4_ATOM_TYPE_MDAT);
-
         // process all track runs
         for (unsigned int i=0; i<handlers.ItemCount(); i++) {
             AP4_Processor::FragmentHandler* handler = handlers[i];
@@ -289,7 +438,24 @@ AP4_Processor::ProcessFragments(AP4_MoovAtom*              moov,
             AP4_TrunAtom* trun = truns[0];
             trun->SetDataOffset((AP4_SI32)((mdat_out_start+mdat_size)-base_data_offset));
             
-            // write the mdat
+            // if possible, process all the samples at once, on several threads
+            bool parallel = false;
+            if (handler && m_ParallelRunner && handler->CanProcessSamplesInParallel()) {
+                result = AP4_ProcessSamplesInParallel(*m_ParallelRunner, 
+                                                      *handler,
+                                                      *sample_tables[i],
+                                                      track_buffers[i],
+                                                      parallel_samples_in,
+                                                      parallel_samples_out,
+                                                      timer,
+                                                      tfhd->GetTrackId());
+                if (AP4_FAILED(result)) return result;
+                parallel = true;
+                AP4_ByteStream::Buffer buffer = { track_buffers[i].GetData(), track_buffers[i].GetDataSize() };
+                fragment_buffers.Append(buffer);
+            }
+            
+            // list the mdat payload
             AP4_UI32 default_sample_size = 0;
             for (unsigned int j=0; j<sample_tables[i]->GetSampleCount(); j++, trun_sample_index++) {
                 // advance the trun index if necessary
@@ -299,40 +465,57 @@ AP4_Processor::ProcessFragments(AP4_MoovAtom*              moov,
                     trun_sample_index = 0;
                 }
                 
+                // the samples processed in parallel are listed all at once above
+                if (parallel) {
+                    AP4_DataBuffer& data_out = parallel_samples_out[j];
+                    mdat_size += data_out.GetDataSize();
+                    trun->UseEntries()[trun_sample_index].sample_size = data_out.GetDataSize();
+                    if (default_sample_size == 0 && (trun->GetFlags() & AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT) == 0) {
+                        default_sample_size = data_out.GetDataSize();
+                    }
+                    continue;
+                }
+                
                 // get the next sample
+                timer.Restart();
                 result = sample_tables[i]->GetSample(j, sample);
                 if (AP4_FAILED(result)) return result;
-                sample.ReadData(sample_data_in);
+                // use the input data where it is if possible, or else read a copy,
+                // which can then be processed in place
+                AP4_DataBuffer& sample_buffer = sample_buffers[sample_buffer_index++];
+                AP4_DataBuffer* data_in = &sample_data_view;
+                bool in_place = false;
+                if (AP4_FAILED(sample.ReadDataView(sample_data_view))) {
+                    in_place = handler == NULL || handler->CanProcessSampleInPlace();
+                    data_in  = in_place ? &sample_buffer : &sample_data_in;
+                    sample.ReadData(*data_in);
+                }
+                timer.Report(Instrumentation::PHASE_READ, tfhd->GetTrackId(), data_in->GetDataSize(), 1);
                 
-                // process the sample data
+                // process the sample data (unmodified without a handler)
+                const AP4_DataBuffer* data_out = data_in;
                 if (handler) {
-                    result = handler->ProcessSample(sample_data_in, sample_data_out);
+                    AP4_Size in_size = data_in->GetDataSize();
+                    result = handler->ProcessSample(*data_in, sample_buffer);
                     if (AP4_FAILED(result)) return result;
+                    timer.Report(Instrumentation::PHASE_PROCESS, tfhd->GetTrackId(), in_size, 1);
+                    data_out = &sample_buffer;
 
-                    // write the sample data
-                    result = output.Write(sample_data_out.GetData(), sample_data_out.GetDataSize());
-                    if (AP4_FAILED(result)) return result;
-
-                    // update the mdat size
-                    mdat_size += sample_data_out.GetDataSize();
-                    
                     // update the trun entry
-                    trun->UseEntries()[trun_sample_index].sample_size = sample_data_out.GetDataSize();
+                    trun->UseEntries()[trun_sample_index].sample_size = data_out->GetDataSize();
 
                     // if this entry uses the default sample size, adjust the default accordingly
                     // (NOTE: there's only one default, so this assumes, of course, that all sample
                     // sizes change the same way, if they change at all)
                     if (default_sample_size == 0 && (trun->GetFlags() & AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT) == 0) {
-                        default_sample_size = sample_data_out.GetDataSize();
+                        default_sample_size = data_out->GetDataSize();
                     }
-                } else {
-                    // write the sample data (unmodified)
-                    result = output.Write(sample_data_in.GetData(), sample_data_in.GetDataSize());
-                    if (AP4_FAILED(result)) return result;
-
-                    // update the mdat size
-                    mdat_size += sample_data_in.GetDataSize();
                 }
+                
+                // list the sample data where it is, to be written with the fragment
+                AP4_ByteStream::Buffer buffer = { data_out->GetData(), data_out->GetDataSize() };
+                fragment_buffers.Append(buffer);
+                mdat_size += data_out->GetDataSize();
             }
 
             if (handler) {
@@ -351,20 +534,22 @@ AP4_Processor::ProcessFragments(AP4_MoovAtom*              moov,
             }
         }
 
-        // update the mdat header
-        AP4_Position mdat_out_end;
-        output.Tell(mdat_out_end);
-#if defined(AP4_DEBUG)
-        AP4_ASSERT(mdat_out_end-mdat_out_start == mdat_size);
-#endif
-        output.Seek(mdat_out_start);
-        output.WriteUI32((AP4_UI32)mdat_size);
-        output.Seek(mdat_out_end);
+        // serialize the moof, now up to date, and the mdat header
+        timer.Restart();
+        fragment_header.SetDataSize(0);
+        AP4_MemoryByteStream* header = new AP4_MemoryByteStream(fragment_header);
+        moof->Write(*header);
+        header->WriteUI32((AP4_UI32)mdat_size);
+        header->WriteUI32(AP4_ATOM_TYPE_MDAT);
+        header->Release();
+        fragment_buffers[0].m_Data = fragment_header.GetData();
+        fragment_buffers[0].m_Size = fragment_header.GetDataSize();
         
-        // update the moof if needed
-        output.Seek(moof_out_start);
-        moof->Write(output);
-        output.Seek(mdat_out_end);
+        // write the whole fragment, straight from the sample buffers
+        result = output.WriteBuffers(&fragment_buffers[0], fragment_buffers.ItemCount());
+        if (AP4_FAILED(result)) return result;
+        AP4_Position mdat_out_end = mdat_out_start+mdat_size;
+        timer.Report(Instrumentation::PHASE_WRITE, 0, fragment_header.GetDataSize()+mdat_size-AP4_ATOM_HEADER_SIZE, fragment_sample_count);
         
         // update the sidx if we have one
         if (sidx && fragment_index < sidx->GetReferences().ItemCount()) {
@@ -440,6 +625,9 @@ AP4_Processor::Process(AP4_ByteStream&   input,
                        ProgressListener* listener,
                        AP4_AtomFactory&  atom_factory)
 {
+    // the track handlers are re-created below
+    UnloadInit();
+
     // read all atoms.
     // keep all atoms except [mdat]
     // keep a ref to [moov]
@@ -452,6 +640,7 @@ AP4_Processor::Process(AP4_ByteStream&   input,
     AP4_UI64                    stream_offset = 0;
     bool                        in_fragments = false;
     unsigned int                sidx_count = 0;
+    AP4_PhaseTimer              timer(m_Instrumentation);
     for (AP4_Atom* atom = NULL;
         AP4_SUCCEEDED(atom_factory.CreateAtomFromStream(input, atom));
         input.Tell(stream_offset)) {
@@ -484,6 +673,11 @@ AP4_Processor::Process(AP4_ByteStream&   input,
         }
         top_level.AddChild(atom);
     }
+    if (m_Instrumentation) {
+        AP4_Position parsed_size = 0;
+        input.Tell(parsed_size);
+        timer.Report(Instrumentation::PHASE_PARSE, 0, parsed_size, 0);
+    }
 
     // check that we have at most one sidx (we can't deal with multi-sidx streams here
     if (sidx_count > 1) {
@@ -495,6 +689,7 @@ AP4_Processor::Process(AP4_ByteStream&   input,
     // if we have a fragments stream, get the fragment locators from there
     if (fragments) {
         stream_offset = 0;
+        timer.Restart();
         for (AP4_Atom* atom = NULL;
             AP4_SUCCEEDED(atom_factory.CreateAtomFromStream(*fragments, atom));
             fragments->Tell(stream_offset)) {
@@ -504,6 +699,7 @@ AP4_Processor::Process(AP4_ByteStream&   input,
             }
             frags.Add(new AP4_AtomLocator(atom, stream_offset));
         }
+        timer.Report(Instrumentation::PHASE_PARSE, 0, stream_offset, 0);
     }
     
     // initialize the processor
@@ -550,6 +746,7 @@ AP4_Processor::Process(AP4_ByteStream&   input,
             m_TrackHandlers[index] = CreateTrackHandler(trak);
             m_TrackIds[index]      = trak->GetId();
             cursors[index].m_Locator.m_TrakIndex   = index;
+            timer.Restart();
             cursors[index].m_Locator.m_SampleTable = new AP4_AtomSampleTable(stbl, *trak_data_stream);
             cursors[index].m_Locator.m_SampleIndex = 0;
             cursors[index].m_Locator.m_ChunkIndex  = 0;
@@ -558,11 +755,16 @@ AP4_Processor::Process(AP4_ByteStream&   input,
             } else {
                 cursors[index].m_EndReached = true;
             }
+            timer.Report(Instrumentation::PHASE_SAMPLE_TABLE,
+                         trak->GetId(),
+                         stbl->GetSize(),
+                         cursors[index].m_Locator.m_SampleTable->GetSampleCount());
 
             index++;            
         }
 
         // figure out the layout of the chunks
+        timer.Restart();
         for (;;) {
             // see which is the next sample to write
             AP4_UI64 min_offset = (AP4_UI64)(-1);
@@ -625,6 +827,7 @@ AP4_Processor::Process(AP4_ByteStream&   input,
             current_chunk_size += sample_size;
             mdat_payload_size  += sample_size;
         }
+        timer.Report(Instrumentation::PHASE_SAMPLE_TABLE, 0, 0, locators.ItemCount());
 
         // process the tracks (ex: sample descriptions processing)
         for (AP4_Ordinal i=0; i<track_count; i++) {
@@ -656,6 +859,7 @@ AP4_Processor::Process(AP4_ByteStream&   input,
         }
 
         // write all atoms
+        timer.Restart();
         top_level.GetChildren().Apply(AP4_AtomListWriter(output));
 
         // write mdat header
@@ -671,6 +875,7 @@ AP4_Processor::Process(AP4_ByteStream&   input,
                 output.WriteUI64(mdat_header_size+mdat_payload_size);
             }
         }        
+        timer.Report(Instrumentation::PHASE_WRITE, 0, atoms_size+(mdat_payload_size?mdat_header_size:0), 0);
     }
     
     // write the samples
@@ -681,18 +886,29 @@ AP4_Processor::Process(AP4_ByteStream&   input,
             output.Tell(before);
 #endif
             AP4_Sample     sample;
-            AP4_DataBuffer data_in;
+            AP4_DataBuffer data_copy;
+            AP4_DataBuffer data_view;
             AP4_DataBuffer data_out;
             for (unsigned int i=0; i<locators.ItemCount(); i++) {
-                AP4_SampleLocator& locator = locators[i];
-                locator.m_Sample.ReadData(data_in);
+                AP4_SampleLocator& locator  = locators[i];
+                AP4_UI32           track_id = m_TrackIds[locator.m_TrakIndex];
+                timer.Restart();
+                AP4_DataBuffer* data_in = &data_view;
+                if (AP4_FAILED(locator.m_Sample.ReadDataView(data_view))) {
+                    locator.m_Sample.ReadData(data_copy);
+                    data_in = &data_copy;
+                }
+                timer.Report(Instrumentation::PHASE_READ, track_id, data_in->GetDataSize(), 1);
                 TrackHandler* handler = m_TrackHandlers[locator.m_TrakIndex];
                 if (handler) {
-                    result = handler->ProcessSample(data_in, data_out);
+                    result = handler->ProcessSample(*data_in, data_out);
                     if (AP4_FAILED(result)) return result;
+                    timer.Report(Instrumentation::PHASE_PROCESS, track_id, data_in->GetDataSize(), 1);
                     output.Write(data_out.GetData(), data_out.GetDataSize());
+                    timer.Report(Instrumentation::PHASE_WRITE, track_id, data_out.GetDataSize(), 1);
                 } else {
-                    output.Write(data_in.GetData(), data_in.GetDataSize());            
+                    output.Write(data_in->GetData(), data_in->GetDataSize());            
+                    timer.Report(Instrumentation::PHASE_WRITE, track_id, data_in->GetDataSize(), 1);
                 }
 
                 // notify the progress listener
@@ -726,20 +942,28 @@ AP4_Processor::Process(AP4_ByteStream&   input,
         result = ProcessFragments(moov, frags, mfra, sidx, sidx_position, fragments?*fragments:input, output);
         if (AP4_FAILED(result)) return result;
         
-        // update and re-write the sidx if we have one
+        // update and re-write the sidx if we have one (the fragments
+        // themselves don't need to seek, but this does)
         if (sidx && sidx_position) {
             AP4_Position where = 0;
-            output.Tell(where);
-            output.Seek(sidx_position);
+            timer.Restart();
+            result = output.Tell(where);
+            if (AP4_FAILED(result)) return result;
+            result = output.Seek(sidx_position);
+            if (AP4_FAILED(result)) return AP4_ERROR_NOT_SUPPORTED;
             result = sidx->Write(output);
             if (AP4_FAILED(result)) return result;
-            output.Seek(where);
+            result = output.Seek(where);
+            if (AP4_FAILED(result)) return result;
+            timer.Report(Instrumentation::PHASE_WRITE, 0, sidx->GetSize(), 0);
         }
         
         if (!fragments) {
             // write the mfra atom at the end if we have one
             if (mfra) {
+                timer.Restart();
                 mfra->Write(output);
+                timer.Report(Instrumentation::PHASE_WRITE, 0, mfra->GetSize(), 0);
             }
         }
         
@@ -789,6 +1013,116 @@ AP4_Processor::Process(AP4_ByteStream&   fragments,
     return Process(init, output, &fragments, listener, atom_factory);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Processor::LoadInit
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Processor::LoadInit(AP4_ByteStream&  init, 
+                        AP4_ByteStream*  output,
+                        AP4_AtomFactory& atom_factory)
+{
+    // discard any previously loaded init data
+    UnloadInit();
+    
+    // read all atoms up to the [moov]
+    AP4_AtomParent top_level;
+    AP4_MoovAtom*  moov = NULL;
+    AP4_PhaseTimer timer(m_Instrumentation);
+    for (AP4_Atom* atom = NULL; 
+         moov == NULL && AP4_SUCCEEDED(atom_factory.CreateAtomFromStream(init, atom));) {
+        top_level.AddChild(atom);
+        if (atom->GetType() == AP4_ATOM_TYPE_MOOV) {
+            moov = AP4_DYNAMIC_CAST(AP4_MoovAtom, atom);
+        }
+    }
+    if (moov == NULL) return AP4_ERROR_INVALID_FORMAT;
+    AP4_UI64 init_size = 0;
+    top_level.GetChildren().Apply(AP4_AtomSizeAdder(init_size));
+    timer.Report(Instrumentation::PHASE_PARSE, 0, init_size, 0);
+    
+    // initialize the processor
+    AP4_Result result = Initialize(top_level, init);
+    if (AP4_FAILED(result)) return result;
+    
+    // create and keep the track handlers
+    for (AP4_List<AP4_TrakAtom>::Item* item = moov->GetTrakAtoms().FirstItem(); item; item=item->GetNext()) {
+        AP4_TrakAtom* trak = item->GetData();
+        TrackHandler* handler = CreateTrackHandler(trak);
+        m_TrackIds.Append(trak->GetId());
+        m_TrackHandlers.Append(handler);
+        if (handler) handler->ProcessTrack();
+    }
+    
+    // finalize the processor
+    result = Finalize(top_level);
+    
+    // write the processed init data if needed
+    if (AP4_SUCCEEDED(result) && output) {
+        timer.Restart();
+        AP4_UI64 output_size = 0;
+        for (AP4_List<AP4_Atom>::Item* item = top_level.GetChildren().FirstItem(); 
+             item && AP4_SUCCEEDED(result); 
+             item = item->GetNext()) {
+            result = item->GetData()->Write(*output);
+            output_size += item->GetData()->GetSize();
+        }
+        timer.Report(Instrumentation::PHASE_WRITE, 0, output_size, 0);
+    }
+    
+    // keep the [moov], the track handlers refer to it
+    moov->Detach();
+    m_InitMoov = moov;
+    
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Processor::ProcessFragments
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Processor::ProcessFragments(AP4_ByteStream&  fragments,
+                                AP4_ByteStream&  output,
+                                AP4_AtomFactory& atom_factory)
+{
+    if (m_InitMoov == NULL) return AP4_ERROR_INVALID_STATE;
+    
+    // read all atoms except [mdat]
+    AP4_List<AP4_AtomLocator> frags;
+    AP4_UI64                  stream_offset = 0;
+    AP4_PhaseTimer            timer(m_Instrumentation);
+    for (AP4_Atom* atom = NULL;
+        AP4_SUCCEEDED(atom_factory.CreateAtomFromStream(fragments, atom));
+        fragments.Tell(stream_offset)) {
+        if (atom->GetType() == AP4_ATOM_TYPE_MDAT) {
+            delete atom;
+            continue;
+        }
+        frags.Add(new AP4_AtomLocator(atom, stream_offset));
+    }
+    timer.Report(Instrumentation::PHASE_PARSE, 0, stream_offset, 0);
+    
+    // process the fragments
+    AP4_Result result = ProcessFragments(m_InitMoov, frags, NULL, NULL, 0, fragments, output);
+    frags.DeleteReferences();
+    
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Processor::UnloadInit
++---------------------------------------------------------------------*/
+void
+AP4_Processor::UnloadInit()
+{
+    for (unsigned int i=0; i<m_TrackHandlers.ItemCount(); i++) {
+        delete m_TrackHandlers[i];
+    }
+    m_TrackHandlers.Clear();
+    m_TrackIds.Clear();
+    delete m_InitMoov;
+    m_InitMoov = NULL;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Processor:Initialize
 +---------------------------------------------------------------------*/
@@ -46,6 +46,7 @@ class AP4_ByteStream;
 class AP4_DataBuffer;
 class AP4_TrakAtom;
 class AP4_TrexAtom;
+class AP4_MoovAtom;
 class AP4_SidxAtom;
 class AP4_FragmentSampleTable;
 struct AP4_AtomLocator;
@@ -78,6 +79,91 @@ public:
                                       unsigned int total) = 0;
     };
 
+    /**
+     * Abstract class that defines the interface implemented by parallel
+     * runners. A parallel runner is used by AP4_Processor to process the
+     * samples of a fragment on several threads, when the fragment handler
+     * supports it.
+     */
+    class ParallelRunner {
+    public:
+        /**
+         * Work on a number of items, that can be split into ranges of
+         * items processed independently of each other.
+         */
+        class Job {
+        public:
+            virtual ~Job() {}
+
+            /**
+             * Process the items [first, first+count).
+             * This method may be called concurrently, from different 
+             * threads, for different ranges of items.
+             */
+            virtual AP4_Result Run(AP4_Ordinal first, AP4_Cardinal count) = 0;
+        };
+
+        virtual ~ParallelRunner() {}
+
+        /**
+         * Run a job on the items [0, item_count), by splitting them into
+         * ranges that cover every item exactly once, and calling Job::Run()
+         * for each range, possibly concurrently.
+         * This method must only return once all the ranges have been run.
+         * @return AP4_SUCCESS if all the ranges succeeded, or the error
+         * returned by one of the ranges otherwise.
+         */
+        virtual AP4_Result Run(Job& job, AP4_Cardinal item_count) = 0;
+    };
+
+    /**
+     * Abstract class that defines the interface implemented by
+     * instrumentation listeners. An instrumentation listener is told how
+     * much time AP4_Processor spends in each phase of the processing, and
+     * how many bytes and samples it handles in each phase, so that it can
+     * add them up per phase and per track.
+     */
+    class Instrumentation {
+    public:
+        /**
+         * Phases of the processing.
+         */
+        typedef enum {
+            PHASE_PARSE,        ///< Parsing atoms from the input
+            PHASE_SAMPLE_TABLE, ///< Creating and walking sample tables
+            PHASE_READ,         ///< Reading sample data
+            PHASE_PROCESS,      ///< Processing sample data with the handlers
+            PHASE_WRITE         ///< Writing, and re-writing, the output
+        } Phase;
+
+        virtual ~Instrumentation() {}
+
+        /**
+         * Returns the current time, in nanoseconds, from a monotonic clock
+         * of the listener's choosing. It is only called while processing
+         * with an instrumentation listener set, so there is no timing
+         * overhead otherwise.
+         */
+        virtual AP4_UI64 GetTime() = 0;
+
+        /**
+         * This method is called each time some work has been done in a
+         * phase. It is always called from the thread calling the
+         * AP4_Processor method, even for samples processed in parallel.
+         * @param phase Phase in which the work was done.
+         * @param track_id ID of the track for which the work was done, or
+         * 0 if the work was not specific to one track.
+         * @param duration Time spent, in nanoseconds.
+         * @param bytes Number of bytes handled.
+         * @param samples Number of samples handled.
+         */
+        virtual void OnPhase(Phase        phase,
+                             AP4_UI32     track_id,
+                             AP4_UI64     duration,
+                             AP4_UI64     bytes,
+                             AP4_Cardinal samples) = 0;
+    };
+
     /**
      * Abstract class that defines the interface implemented by concrete
      * track handlers. A track handler is responsible for processing a 
@@ -108,6 +194,7 @@ public:
         /**
          * Process the data of one sample.
          * @param data_in Data buffer with the data of the sample to process.
+         * It may refer to the input data where it is, and must not be modified.
          * @param data_out Data buffer in which the processed sample data is
          * returned.
          */
@@ -151,23 +238,67 @@ public:
         /**
          * Process the data of one sample.
          * @param data_in Data buffer with the data of the sample to process.
+         * Unless the sample is processed in place, it may refer to the input
+         * data where it is, and must not be modified.
          * @param data_out Data buffer in which the processed sample data is
          * returned.
          */
         virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out) = 0;
+
+        /**
+         * A fragment handler may override this method to return true if
+         * ProcessSample() can be called with the same buffer for data_in
+         * and data_out, in which case the sample data is processed in place.
+         */
+        virtual bool CanProcessSampleInPlace() { return false; }
+
+        /**
+         * A fragment handler may override this method to return true if
+         * it implements ProcessSamples(), which processes the samples 
+         * without changing their size, and independently of the order in
+         * which they are processed.
+         */
+        virtual bool CanProcessSamplesInParallel() { return false; }
+
+        /**
+         * Process the data of a range of samples.
+         * This method may be called concurrently, from different threads,
+         * for different ranges of samples of the same fragment.
+         * @param first Index of the first sample to process.
+         * @param count Number of samples to process.
+         * @param samples_in Array with the data of all the samples of the 
+         * fragment, indexed by sample index. Unless it is the same array as
+         * samples_out, in which case the samples are processed in place, 
+         * its buffers may refer to the input data, and must not be modified.
+         * @param samples_out Array of buffers, indexed by sample index, with
+         * room for the processed data of each sample.
+         */
+        virtual AP4_Result ProcessSamples(AP4_Ordinal     /* first       */,
+                                          AP4_Cardinal    /* count       */,
+                                          AP4_DataBuffer* /* samples_in  */,
+                                          AP4_DataBuffer* /* samples_out */) {
+            return AP4_ERROR_NOT_SUPPORTED;
+        }
     };
 
+    /**
+     *  Default constructor
+     */
+    AP4_Processor() : m_InitMoov(NULL), m_ParallelRunner(NULL), m_Instrumentation(NULL) {}
+
     /**
      *  Default destructor
      */
-    virtual ~AP4_Processor() { m_ExternalTrackData.DeleteReferences(); }
+    virtual ~AP4_Processor() { UnloadInit(); m_ExternalTrackData.DeleteReferences(); }
 
     /**
      * Process the input stream into an output stream.
      * @param input Input stream from which to read the input file.
      * @param output Output stream to which the processed input
-     * will be written.
+     * will be written. It only needs to be able to seek back when
+     * the input has a sidx atom, which is rewritten at the end;
+     * AP4_ERROR_NOT_SUPPORTED is returned otherwise.
      * @param listener Pointer to a listener, or NULL. The listener
      * will be called one or more times before this method returns, 
      * with progress information.
@@ -195,6 +326,50 @@ public:
                        AP4_AtomFactory&  atom_factory = 
                            AP4_DefaultAtomFactory::Instance_);
 
+    /**
+     * Load the init data once, so that any number of fragment streams can
+     * then be processed with ProcessFragments() without parsing the init
+     * data and creating the track handlers again each time.
+     * The init data remains loaded until the processor is destroyed, or
+     * until Process() is called.
+     * @param init Input stream from which to read the init data.
+     * @param output Output stream to which the processed init data will
+     * be written, or NULL if it is not needed.
+     */
+    AP4_Result LoadInit(AP4_ByteStream&  init,
+                        AP4_ByteStream*  output = NULL,
+                        AP4_AtomFactory& atom_factory = 
+                            AP4_DefaultAtomFactory::Instance_);
+
+    /**
+     * Process a fragment input stream into an output stream, using the
+     * init data previously loaded with LoadInit().
+     * @param fragments Input stream from which to read the fragments.
+     * @param output Output stream to which the processed fragments
+     * will be written.
+     */
+    AP4_Result ProcessFragments(AP4_ByteStream&  fragments,
+                                AP4_ByteStream&  output,
+                                AP4_AtomFactory& atom_factory = 
+                                    AP4_DefaultAtomFactory::Instance_);
+
+    /**
+     * Set a parallel runner, used to process the samples of fragments
+     * on several threads, for fragment handlers that support it.
+     * The output is the same as without a parallel runner.
+     * @param runner Parallel runner, or NULL to process the samples one
+     * at a time. The runner is not owned by the processor.
+     */
+    void SetParallelRunner(ParallelRunner* runner) { m_ParallelRunner = runner; }
+
+    /**
+     * Set an instrumentation listener, told about the time spent in each
+     * phase of the processing.
+     * @param instrumentation Instrumentation listener, or NULL for none.
+     * The listener is not owned by the processor.
+     */
+    void SetInstrumentation(Instrumentation* instrumentation) { m_Instrumentation = instrumentation; }
+
     /**
      * This method can be overridden by concrete subclasses.
      * It is called just after the input stream has been parsed into
@@ -266,10 +441,14 @@ protected:
                                 AP4_ByteStream&            input, 
                                 AP4_ByteStream&            output);
     
+    void UnloadInit();
     
     AP4_List<ExternalTrackData> m_ExternalTrackData;
     AP4_Array<AP4_UI32>         m_TrackIds;
     AP4_Array<TrackHandler*>    m_TrackHandlers;
+    AP4_MoovAtom*               m_InitMoov;
+    ParallelRunner*             m_ParallelRunner;
+    Instrumentation*            m_Instrumentation;
 };
 
 #endif // _AP4_PROCESSOR_H_
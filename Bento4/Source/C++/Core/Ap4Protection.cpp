@@ -322,10 +322,36 @@ AP4_ProtectionSchemeInfo::AP4_ProtectionSchemeInfo(AP4_ContainerAtom* schi)
     }
 }
 
+/*----------------------------------------------------------------------
+|   AP4_HashTrackId
++---------------------------------------------------------------------*/
+static AP4_UI32
+AP4_HashTrackId(AP4_UI32 track_id)
+{
+    return track_id*2654435761U;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_HashKid
++---------------------------------------------------------------------*/
+static AP4_UI32
+AP4_HashKid(const AP4_UI08* kid)
+{
+    // FNV-1a
+    AP4_UI32 hash = 2166136261U;
+    for (unsigned int i=0; i<16; i++) {
+        hash = (hash^kid[i])*16777619U;
+    }
+    return hash;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_ProtectionKeyMap::AP4_ProtectionKeyMap
 +---------------------------------------------------------------------*/
-AP4_ProtectionKeyMap::AP4_ProtectionKeyMap()
+AP4_ProtectionKeyMap::AP4_ProtectionKeyMap() :
+    m_TrackIdIndex(NULL),
+    m_KidIndex(NULL),
+    m_IndexSize(0)
 {
 }
 
@@ -335,6 +361,8 @@ AP4_ProtectionKeyMap::AP4_ProtectionKeyMap()
 AP4_ProtectionKeyMap::~AP4_ProtectionKeyMap()
 {
     m_KeyEntries.DeleteReferences();
+    delete[] m_TrackIdIndex;
+    delete[] m_KidIndex;
 }
 
 /*----------------------------------------------------------------------
@@ -349,7 +377,7 @@ AP4_ProtectionKeyMap::SetKey(AP4_UI32        track_id,
 {
     KeyEntry* entry = GetEntry(track_id);
     if (entry == NULL) {
-        m_KeyEntries.Add(new KeyEntry(track_id, key, key_size, iv, iv_size));
+        AddEntry(new KeyEntry(track_id, key, key_size, iv, iv_size));
     } else {
         entry->SetKey(key, key_size, iv, iv_size);
     }
@@ -369,7 +397,7 @@ AP4_ProtectionKeyMap::SetKeyForKid(const AP4_UI08* kid,
 {
     KeyEntry* entry = GetEntryByKid(kid);
     if (entry == NULL) {
-        m_KeyEntries.Add(new KeyEntry(kid, key, key_size, iv, iv_size));
+        AddEntry(new KeyEntry(kid, key, key_size, iv, iv_size));
     } else {
         entry->SetKey(key, key_size, iv, iv_size);
     }
@@ -386,11 +414,11 @@ AP4_ProtectionKeyMap::SetKeys(const AP4_ProtectionKeyMap& key_map)
     AP4_List<KeyEntry>::Item* item = key_map.m_KeyEntries.FirstItem();
     while (item) {
         KeyEntry* entry = item->GetData();
-        m_KeyEntries.Add(new KeyEntry(entry->m_TrackId,
-                                      entry->m_Key.GetData(),
-                                      entry->m_Key.GetDataSize(),
-                                      entry->m_IV.GetData(),
-                                      entry->m_IV.GetDataSize()));
+        AddEntry(new KeyEntry(entry->m_TrackId,
+                              entry->m_Key.GetData(),
+                              entry->m_Key.GetDataSize(),
+                              entry->m_IV.GetData(),
+                              entry->m_IV.GetDataSize()));
         item = item->GetNext();
     }
     return AP4_SUCCESS;
@@ -470,11 +498,10 @@ AP4_ProtectionKeyMap::GetKeyByKid(const AP4_UI08* kid) const
 AP4_ProtectionKeyMap::KeyEntry*
 AP4_ProtectionKeyMap::GetEntry(AP4_UI32 track_id) const
 {
-    AP4_List<KeyEntry>::Item* item = m_KeyEntries.FirstItem();
-    while (item) {
-        KeyEntry* entry = item->GetData();
-        if (entry->m_TrackId == track_id) return entry;
-        item = item->GetNext();
+    if (m_IndexSize == 0) return NULL;
+    AP4_UI32 mask = m_IndexSize-1;
+    for (AP4_UI32 i = AP4_HashTrackId(track_id)&mask; m_TrackIdIndex[i]; i = (i+1)&mask) {
+        if (m_TrackIdIndex[i]->m_TrackId == track_id) return m_TrackIdIndex[i];
     }
 
     return NULL;
@@ -486,16 +513,66 @@ AP4_ProtectionKeyMap::GetEntry(AP4_UI32 track_id) const
 AP4_ProtectionKeyMap::KeyEntry*
 AP4_ProtectionKeyMap::GetEntryByKid(const AP4_UI08* kid) const
 {
-    AP4_List<KeyEntry>::Item* item = m_KeyEntries.FirstItem();
-    while (item) {
-        KeyEntry* entry = item->GetData();
-        if (AP4_CompareMemory(entry->m_KID, kid, 16) == 0) return entry;
-        item = item->GetNext();
+    if (m_IndexSize == 0) return NULL;
+    AP4_UI32 mask = m_IndexSize-1;
+    for (AP4_UI32 i = AP4_HashKid(kid)&mask; m_KidIndex[i]; i = (i+1)&mask) {
+        if (AP4_CompareMemory(m_KidIndex[i]->m_KID, kid, 16) == 0) return m_KidIndex[i];
     }
 
     return NULL;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_ProtectionKeyMap::AddEntry
++---------------------------------------------------------------------*/
+void
+AP4_ProtectionKeyMap::AddEntry(KeyEntry* entry)
+{
+    m_KeyEntries.Add(entry);
+
+    // keep the indexes at most half full
+    AP4_Cardinal entry_count = m_KeyEntries.ItemCount();
+    if (2*entry_count <= m_IndexSize) {
+        IndexEntry(entry);
+        return;
+    }
+
+    // grow the indexes and index all the entries again
+    delete[] m_TrackIdIndex;
+    delete[] m_KidIndex;
+    if (m_IndexSize == 0) m_IndexSize = 16;
+    while (2*entry_count > m_IndexSize) m_IndexSize *= 2;
+    m_TrackIdIndex = new KeyEntry*[m_IndexSize];
+    m_KidIndex     = new KeyEntry*[m_IndexSize];
+    AP4_SetMemory(m_TrackIdIndex, 0, m_IndexSize*sizeof(KeyEntry*));
+    AP4_SetMemory(m_KidIndex,     0, m_IndexSize*sizeof(KeyEntry*));
+    for (AP4_List<KeyEntry>::Item* item = m_KeyEntries.FirstItem(); item; item = item->GetNext()) {
+        IndexEntry(item->GetData());
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ProtectionKeyMap::IndexEntry
++---------------------------------------------------------------------*/
+void
+AP4_ProtectionKeyMap::IndexEntry(KeyEntry* entry)
+{
+    // entries set by track ID have a zero KID, and entries set by KID have
+    // a zero track ID, so several entries can share a track ID or a KID:
+    // only the first one is indexed, which is the one a search of the
+    // list would find
+    AP4_UI32 mask = m_IndexSize-1;
+    AP4_UI32 i;
+    for (i = AP4_HashTrackId(entry->m_TrackId)&mask; m_TrackIdIndex[i]; i = (i+1)&mask) {
+        if (m_TrackIdIndex[i]->m_TrackId == entry->m_TrackId) break;
+    }
+    if (m_TrackIdIndex[i] == NULL) m_TrackIdIndex[i] = entry;
+    for (i = AP4_HashKid(entry->m_KID)&mask; m_KidIndex[i]; i = (i+1)&mask) {
+        if (AP4_CompareMemory(m_KidIndex[i]->m_KID, entry->m_KID, 16) == 0) break;
+    }
+    if (m_KidIndex[i] == NULL) m_KidIndex[i] = entry;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_ProtectionKeyMap::KeyEntry::KeyEntry
 +---------------------------------------------------------------------*/
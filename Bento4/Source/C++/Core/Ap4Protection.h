@@ -181,9 +181,14 @@ private:
     // methods
     KeyEntry* GetEntry(AP4_UI32 track_id) const;
     KeyEntry* GetEntryByKid(const AP4_UI08* kid) const;
+    void      AddEntry(KeyEntry* entry);
+    void      IndexEntry(KeyEntry* entry);
 
     // members
     AP4_List<KeyEntry> m_KeyEntries;
+    KeyEntry**         m_TrackIdIndex; // open addressing hash table
+    KeyEntry**         m_KidIndex;     // open addressing hash table
+    AP4_Cardinal       m_IndexSize;    // 0 or a power of 2
 };
 
 /*----------------------------------------------------------------------
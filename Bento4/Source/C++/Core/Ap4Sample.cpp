@@ -156,12 +156,36 @@ AP4_Sample::ReadData(AP4_DataBuffer& data, AP4_Size size, AP4_Size offset)
     result = data.SetDataSize(size);
     if (AP4_FAILED(result)) return result;
 
+    // copy the data straight from memory when the stream holds it
+    const AP4_UI08* direct = m_DataStream->GetDirectPointer(m_Offset+offset, size);
+    if (direct) {
+        AP4_CopyMemory(data.UseData(), direct, size);
+        return m_DataStream->Seek(m_Offset+offset+size);
+    }
+
     // get the data from the stream
     result = m_DataStream->Seek(m_Offset+offset);
     if (AP4_FAILED(result)) return result;
     return m_DataStream->Read(data.UseData(), size);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Sample::ReadDataView
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Sample::ReadDataView(AP4_DataBuffer& view)
+{
+    // check that we have a stream
+    if (m_DataStream == NULL) return AP4_FAILURE;
+
+    // check that the stream has the data in memory
+    const AP4_UI08* direct = m_DataStream->GetDirectPointer(m_Offset, m_Size);
+    if (direct == NULL) return AP4_ERROR_NOT_SUPPORTED;
+
+    view.SetBuffer(const_cast<AP4_UI08*>(direct), m_Size);
+    return view.SetDataSize(m_Size);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Sample::GetDataStream
 +---------------------------------------------------------------------*/
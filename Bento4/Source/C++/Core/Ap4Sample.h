@@ -91,6 +91,10 @@ public:
     AP4_Result      ReadData(AP4_DataBuffer& data, 
                              AP4_Size        size, 
                              AP4_Size        offset = 0);
+    // makes view refer to the sample data where it is, without a copy, when
+    // the data stream holds it in memory, or returns AP4_ERROR_NOT_SUPPORTED;
+    // the view must not be modified, and can't be used for anything but views
+    AP4_Result      ReadDataView(AP4_DataBuffer& view);
     void            Detach();
     
     // sample properties accessors
@@ -56,7 +56,10 @@ AP4_StssAtom::Create(AP4_Size size, AP4_ByteStream& stream)
 |   AP4_StssAtom::AP4_StssAtom
 +---------------------------------------------------------------------*/
 AP4_StssAtom::AP4_StssAtom() :
-    AP4_Atom(AP4_ATOM_TYPE_STSS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0)
+    AP4_Atom(AP4_ATOM_TYPE_STSS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0),
+    m_LookupCache(0),
+    m_OrderedEntryCount(0),
+    m_Ordered(true)
 {
 }
 
@@ -68,7 +71,9 @@ AP4_StssAtom::AP4_StssAtom(AP4_UI32        size,
                            AP4_UI32        flags,
                            AP4_ByteStream& stream) :
     AP4_Atom(AP4_ATOM_TYPE_STSS, size, version, flags),
-    m_LookupCache(0)
+    m_LookupCache(0),
+    m_OrderedEntryCount(0),
+    m_Ordered(true)
 {
     if (size - AP4_ATOM_HEADER_SIZE < 4) return;
     AP4_UI32 entry_count;
@@ -154,6 +159,46 @@ AP4_StssAtom::IsSampleSync(AP4_Ordinal sample)
     return false;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_StssAtom::GetEntryIndexForSample
++---------------------------------------------------------------------*/
+AP4_Ordinal
+AP4_StssAtom::GetEntryIndexForSample(AP4_Ordinal sample)
+{
+    // check that the entries are in increasing order, as they should be,
+    // going over each entry only once even as entries are added
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    while (m_Ordered && m_OrderedEntryCount < entry_count) {
+        if (m_OrderedEntryCount && 
+            m_Entries[m_OrderedEntryCount] < m_Entries[m_OrderedEntryCount-1]) {
+            m_Ordered = false;
+        } else {
+            ++m_OrderedEntryCount;
+        }
+    }
+
+    // find the first entry that is not before the sample
+    if (m_Ordered) {
+        AP4_Ordinal low  = 0;
+        AP4_Ordinal high = entry_count;
+        while (low < high) {
+            AP4_Ordinal middle = low+(high-low)/2;
+            if (m_Entries[middle] < sample) {
+                low = middle+1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    } else {
+        AP4_Ordinal entry_index = 0;
+        while (entry_index < entry_count && m_Entries[entry_index] < sample) {
+            ++entry_index;
+        }
+        return entry_index;
+    }
+}
+
 /*----------------------------------------------------------------------
 |   AP4_StssAtom::InspectFields
 +---------------------------------------------------------------------*/
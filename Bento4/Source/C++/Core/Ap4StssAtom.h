@@ -55,6 +55,7 @@ public:
     AP4_Result                 AddEntry(AP4_UI32 sample);
     virtual AP4_Result         InspectFields(AP4_AtomInspector& inspector);
     virtual bool               IsSampleSync(AP4_Ordinal sample);
+    virtual AP4_Ordinal        GetEntryIndexForSample(AP4_Ordinal sample);
     virtual AP4_Result         WriteFields(AP4_ByteStream& stream);
 
 private:
@@ -67,6 +68,8 @@ private:
     // members
     AP4_Array<AP4_UI32> m_Entries;
     AP4_Ordinal         m_LookupCache;
+    AP4_Cardinal        m_OrderedEntryCount; // entries known to be in order
+    bool                m_Ordered;
 };
 
 #endif // _AP4_STSS_ATOM_H_
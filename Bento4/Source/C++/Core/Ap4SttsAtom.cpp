@@ -103,42 +103,73 @@ AP4_SttsAtom::GetDts(AP4_Ordinal sample, AP4_UI64& dts, AP4_UI32* duration)
     if (sample == 0) return AP4_ERROR_OUT_OF_RANGE;
     --sample;
 
-    // check the lookup cache
-    AP4_Ordinal lookup_start = 0;
-    AP4_Ordinal sample_start = 0;
-    AP4_UI64    dts_start    = 0;
-    if (sample >= m_LookupCache.sample) {
-        // start from the cached entry
-        lookup_start = m_LookupCache.entry_index;
-        sample_start = m_LookupCache.sample;
-        dts_start    = m_LookupCache.dts;
+    // start from the entry used last time, when the sample is in it,
+    // and otherwise look the entry up in the index
+    AP4_Ordinal entry_index = m_LookupCache.entry_index;
+    UpdateIndex();
+    if (entry_index >= m_Entries.ItemCount() ||
+        sample < m_LookupCache.sample        ||
+        sample >= m_SampleCountIndex[entry_index]) {
+        entry_index = FindEntry(m_SampleCountIndex, sample);
+
+        // sample is greater than the number of samples
+        if (entry_index >= m_Entries.ItemCount()) return AP4_ERROR_OUT_OF_RANGE;
+        
+        // update the lookup cache
+        m_LookupCache.entry_index = entry_index;
+        m_LookupCache.sample      = entry_index ? (AP4_Ordinal)m_SampleCountIndex[entry_index-1] : 0;
+        m_LookupCache.dts         = entry_index ? m_DurationIndex[entry_index-1] : 0;
     }
 
-    // look from the last known point
-    for (AP4_Ordinal i = lookup_start; i < m_Entries.ItemCount(); i++) {
-        AP4_SttsTableEntry& entry = m_Entries[i];
-
-        // check if we have reached the sample
-        if (sample < sample_start+entry.m_SampleCount) {
-            // we are within the sample range for the current entry
-            dts = dts_start + (AP4_UI64)(sample - sample_start) * (AP4_UI64)entry.m_SampleDuration;
-            if (duration) *duration = entry.m_SampleDuration;
-            
-            // update the lookup cache
-            m_LookupCache.entry_index = i;
-            m_LookupCache.sample      = sample_start;
-            m_LookupCache.dts         = dts_start;
-            
-            return AP4_SUCCESS;
-        }
- 
-        // update the sample and dts bases
-        sample_start += entry.m_SampleCount;
-        dts_start    += (AP4_UI64)entry.m_SampleCount * (AP4_UI64)entry.m_SampleDuration;
+    // we are within the sample range for the entry
+    AP4_SttsTableEntry& entry = m_Entries[entry_index];
+    dts = m_LookupCache.dts + (AP4_UI64)(sample - m_LookupCache.sample) * (AP4_UI64)entry.m_SampleDuration;
+    if (duration) *duration = entry.m_SampleDuration;
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SttsAtom::UpdateIndex
++---------------------------------------------------------------------*/
+void
+AP4_SttsAtom::UpdateIndex()
+{
+    // the entries can only be appended to, so only index the new ones
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    AP4_Ordinal  first       = m_SampleCountIndex.ItemCount();
+    if (first == entry_count) return;
+    m_SampleCountIndex.EnsureCapacity(entry_count);
+    m_DurationIndex.EnsureCapacity(entry_count);
+    AP4_UI64 sample_count = first ? m_SampleCountIndex[first-1] : 0;
+    AP4_UI64 duration     = first ? m_DurationIndex[first-1]    : 0;
+    for (AP4_Ordinal i=first; i<entry_count; i++) {
+        sample_count += m_Entries[i].m_SampleCount;
+        duration     += (AP4_UI64)m_Entries[i].m_SampleCount * (AP4_UI64)m_Entries[i].m_SampleDuration;
+        m_SampleCountIndex.Append(sample_count);
+        m_DurationIndex.Append(duration);
     }
+}
 
-    // sample is greater than the number of samples
-    return AP4_ERROR_OUT_OF_RANGE;
+/*----------------------------------------------------------------------
+|   AP4_SttsAtom::FindEntry
++---------------------------------------------------------------------*/
+AP4_Ordinal
+AP4_SttsAtom::FindEntry(const AP4_Array<AP4_UI64>& ends, AP4_UI64 value)
+{
+    // binary search for the first entry that ends after the value,
+    // which skips the empty entries
+    AP4_Ordinal low  = 0;
+    AP4_Ordinal high = ends.ItemCount();
+    while (low < high) {
+        AP4_Ordinal middle = low+(high-low)/2;
+        if (ends[middle] > value) {
+            high = middle;
+        } else {
+            low = middle+1;
+        }
+    }
+    return low;
 }
 
 /*----------------------------------------------------------------------
@@ -188,29 +219,20 @@ AP4_SttsAtom::GetSampleIndexForTimeStamp(AP4_UI64      ts,
                                          AP4_Ordinal&  sample_index)
 {
     // init
-    AP4_Cardinal entry_count = m_Entries.ItemCount();
-    AP4_UI64 accumulated = 0;
     sample_index = 0;
-    
-    for (AP4_Ordinal i=0; i<entry_count; i++) {
-        AP4_UI64 next_accumulated = 
-            accumulated +
-            (AP4_UI64)m_Entries[i].m_SampleCount * 
-            (AP4_UI64)m_Entries[i].m_SampleDuration;
-        
-        // check if the ts is in the range of this entry
-        if (ts < next_accumulated) {
-            sample_index += (AP4_UI32)((ts - accumulated) / m_Entries[i].m_SampleDuration);
-            return AP4_SUCCESS;
-        }
+    UpdateIndex();
 
-        // update accumulated and sample
-        accumulated = next_accumulated;
-        sample_index += m_Entries[i].m_SampleCount;
+    // find the entry that the ts falls in
+    AP4_Ordinal entry_index = FindEntry(m_DurationIndex, ts);
+    if (entry_index >= m_Entries.ItemCount()) {
+        // ts not in range of the table
+        return AP4_FAILURE;
     }
+    AP4_UI64 accumulated = entry_index ? m_DurationIndex[entry_index-1] : 0;
+    AP4_UI64 first       = entry_index ? m_SampleCountIndex[entry_index-1] : 0;
+    sample_index = (AP4_Ordinal)(first + (ts - accumulated) / m_Entries[entry_index].m_SampleDuration);
 
-    // ts not in range of the table
-    return AP4_FAILURE;
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
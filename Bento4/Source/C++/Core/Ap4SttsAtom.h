@@ -78,9 +78,13 @@ private:
                  AP4_UI08        version,
                  AP4_UI32        flags,
                  AP4_ByteStream& stream);
+    void         UpdateIndex();
+    AP4_Ordinal  FindEntry(const AP4_Array<AP4_UI64>& ends, AP4_UI64 value);
 
     // members
     AP4_Array<AP4_SttsTableEntry> m_Entries;
+    AP4_Array<AP4_UI64>           m_SampleCountIndex; // samples up to the end of each entry
+    AP4_Array<AP4_UI64>           m_DurationIndex;    // duration up to the end of each entry
     struct {
         AP4_Ordinal entry_index;
         AP4_Ordinal sample;
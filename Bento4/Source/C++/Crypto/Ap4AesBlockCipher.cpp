@@ -41,6 +41,27 @@ Issue Date: 29/07/2002
 #include "Ap4Utils.h"
 #include "Ap4Config.h"
 
+#if !defined(AP4_CONFIG_NO_AES_HARDWARE)
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define AES_HWA_HAVE_AESNI
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define AES_HWA_HAVE_ARMV8
+#if defined(_MSC_VER)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#include <arm_neon.h>
+#endif
+#endif
+
 /*----------------------------------------------------------------------
 |   AES types
 +---------------------------------------------------------------------*/
@@ -51,6 +72,7 @@ struct aes_ctx                     // the AES context for encryption
 {   aes_32t    k_sch[4*AP4_AES_BLOCK_SIZE];   // the encryption key schedule
     aes_32t    n_rnd;              // the number of cipher rounds
     aes_32t    n_blk;              // the number of bytes in the state
+    aes_32t    n_hwa;              // the hardware backend (AES_HWA_XXX)
 };
 #define aes_bad      0             // bad function return value
 #define aes_good     1             // good function return value
@@ -1829,6 +1851,451 @@ static aes_rval aes_dec_blk(const unsigned char in_blk[], unsigned char out_blk[
 
 #endif
 
+/*----------------------------------------------------------------------
+|   hardware acceleration
++---------------------------------------------------------------------*/
+/*  The schedules produced by aes_enc_key() and aes_dec_key() are stored
+    in memory as byte-ordered round keys (the decryption schedule has the
+    inverse MixColumns transform applied to its inner round keys), which
+    is exactly what the AES instructions of modern CPUs expect, so the
+    hardware backends below reuse them as-is.
+
+    Define AP4_CONFIG_NO_AES_HARDWARE to compile the hardware backends
+    out, or set the global option "crypto.aes.disable-hardware" to "true"
+    to make AP4_AesBlockCipher::Create() select the portable code.
+*/
+#define AES_HWA_NONE  0
+#define AES_HWA_AESNI 1
+#define AES_HWA_ARMV8 2
+
+// number of independent blocks processed together by the multi-block loops
+#define AES_PARALLEL_BLOCKS 8
+
+/*----------------------------------------------------------------------
+|   aes_xor
++---------------------------------------------------------------------*/
+/*  out = a ^ b, 64 bits at a time (compilers turn this into vector code).
+    out may be the same as a or b.
+*/
+static inline void aes_xor(AP4_UI08* out, const AP4_UI08* a, const AP4_UI08* b, unsigned int size)
+{
+    unsigned int i = 0;
+    for (; i+8 <= size; i += 8) {
+        AP4_UI64 x, y;
+        AP4_CopyMemory(&x, a+i, 8);
+        AP4_CopyMemory(&y, b+i, 8);
+        x ^= y;
+        AP4_CopyMemory(out+i, &x, 8);
+    }
+    for (; i<size; i++) {
+        out[i] = a[i]^b[i];
+    }
+}
+
+/*----------------------------------------------------------------------
+|   CTR counter helpers
++---------------------------------------------------------------------*/
+/*  A counter block is handled as two 64-bit big-endian halves. Only the
+    last 15 bytes of the block take part in the increment, the first byte
+    is never modified (this matches what AP4_AesCtrBlockCipher has always
+    done).
+*/
+static inline void aes_ctr_load(const AP4_UI08 block[AP4_AES_BLOCK_SIZE], AP4_UI64& hi, AP4_UI64& lo)
+{
+    hi = AP4_BytesToUInt64BE(block);
+    lo = AP4_BytesToUInt64BE(block+8);
+}
+
+static inline void aes_ctr_store(AP4_UI08 block[AP4_AES_BLOCK_SIZE], AP4_UI64 hi, AP4_UI64 lo)
+{
+    for (unsigned int i=0; i<8; i++) {
+        block[i]   = (AP4_UI08)(hi>>(56-8*i));
+        block[i+8] = (AP4_UI08)(lo>>(56-8*i));
+    }
+}
+
+static inline void aes_ctr_increment(AP4_UI64& hi, AP4_UI64& lo)
+{
+    if (++lo == 0) {
+        const AP4_UI64 top = ((AP4_UI64)0xFF)<<56;
+        hi = (hi & top) | ((hi+1) & ~top);
+    }
+}
+
+#if defined(AES_HWA_HAVE_AESNI)
+/*----------------------------------------------------------------------
+|   AES-NI backend
++---------------------------------------------------------------------*/
+#if defined(_MSC_VER)
+#define AES_AESNI_TARGET
+#else
+#define AES_AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+static bool aesni_supported()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1<<25)) && (info[3] & (1<<26));
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+    return (ecx & (1<<25)) && (edx & (1<<26));
+#endif
+}
+
+AES_AESNI_TARGET
+static void aesni_load_schedule(const aes_ctx* cx, __m128i rk[15])
+{
+    const AP4_UI08* k = (const AP4_UI08*)cx->k_sch;
+    for (unsigned int i=0; i<=cx->n_rnd; i++) {
+        rk[i] = _mm_loadu_si128((const __m128i*)(k+16*i));
+    }
+}
+
+AES_AESNI_TARGET
+static inline __m128i aesni_enc_blk(__m128i b, const __m128i rk[15], unsigned int n_rnd)
+{
+    b = _mm_xor_si128(b, rk[0]);
+    for (unsigned int r=1; r<n_rnd; r++) {
+        b = _mm_aesenc_si128(b, rk[r]);
+    }
+    return _mm_aesenclast_si128(b, rk[n_rnd]);
+}
+
+AES_AESNI_TARGET
+static inline __m128i aesni_dec_blk(__m128i b, const __m128i rk[15], unsigned int n_rnd)
+{
+    b = _mm_xor_si128(b, rk[n_rnd]);
+    for (unsigned int r=n_rnd-1; r; r--) {
+        b = _mm_aesdec_si128(b, rk[r]);
+    }
+    return _mm_aesdeclast_si128(b, rk[0]);
+}
+
+AES_AESNI_TARGET
+static void aesni_cbc_encrypt(const aes_ctx*  cx,
+                              const AP4_UI08* in,
+                              AP4_UI08*       out,
+                              unsigned int    block_count,
+                              const AP4_UI08* chaining_block)
+{
+    __m128i rk[15];
+    aesni_load_schedule(cx, rk);
+
+    // each block depends on the previous one, so there's nothing to pipeline
+    __m128i chain = _mm_loadu_si128((const __m128i*)chaining_block);
+    for (unsigned int i=0; i<block_count; i++) {
+        __m128i b = _mm_loadu_si128((const __m128i*)(in+16*i));
+        chain = aesni_enc_blk(_mm_xor_si128(b, chain), rk, cx->n_rnd);
+        _mm_storeu_si128((__m128i*)(out+16*i), chain);
+    }
+}
+
+AES_AESNI_TARGET
+static void aesni_cbc_decrypt(const aes_ctx*  cx,
+                              const AP4_UI08* in,
+                              AP4_UI08*       out,
+                              unsigned int    block_count,
+                              const AP4_UI08* chaining_block)
+{
+    __m128i rk[15];
+    aesni_load_schedule(cx, rk);
+    unsigned int n_rnd = cx->n_rnd;
+
+    // all the ciphertext blocks are known up front, so several blocks
+    // can be in flight at once. Inputs are all loaded before any output
+    // is stored, so in-place operation is safe.
+    __m128i chain = _mm_loadu_si128((const __m128i*)chaining_block);
+    while (block_count >= AES_PARALLEL_BLOCKS) {
+        __m128i c[AES_PARALLEL_BLOCKS];
+        __m128i b[AES_PARALLEL_BLOCKS];
+        for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+            c[j] = _mm_loadu_si128((const __m128i*)(in+16*j));
+            b[j] = _mm_xor_si128(c[j], rk[n_rnd]);
+        }
+        for (unsigned int r=n_rnd-1; r; r--) {
+            for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+                b[j] = _mm_aesdec_si128(b[j], rk[r]);
+            }
+        }
+        for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+            b[j] = _mm_aesdeclast_si128(b[j], rk[0]);
+            b[j] = _mm_xor_si128(b[j], j?c[j-1]:chain);
+            _mm_storeu_si128((__m128i*)(out+16*j), b[j]);
+        }
+        chain = c[AES_PARALLEL_BLOCKS-1];
+        in          += 16*AES_PARALLEL_BLOCKS;
+        out         += 16*AES_PARALLEL_BLOCKS;
+        block_count -= AES_PARALLEL_BLOCKS;
+    }
+    for (; block_count; block_count--) {
+        __m128i c = _mm_loadu_si128((const __m128i*)in);
+        __m128i b = _mm_xor_si128(aesni_dec_blk(c, rk, n_rnd), chain);
+        _mm_storeu_si128((__m128i*)out, b);
+        chain = c;
+        in  += 16;
+        out += 16;
+    }
+}
+
+AES_AESNI_TARGET
+static void aesni_ctr_process(const aes_ctx*  cx,
+                              const AP4_UI08* in,
+                              AP4_Size        in_size,
+                              AP4_UI08*       out,
+                              const AP4_UI08* counter)
+{
+    __m128i rk[15];
+    aesni_load_schedule(cx, rk);
+    unsigned int n_rnd = cx->n_rnd;
+
+    AP4_UI64 hi, lo;
+    aes_ctr_load(counter, hi, lo);
+
+    AP4_UI08 counters[16*AES_PARALLEL_BLOCKS];
+    while (in_size >= 16*AES_PARALLEL_BLOCKS) {
+        __m128i b[AES_PARALLEL_BLOCKS];
+        for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+            aes_ctr_store(counters+16*j, hi, lo);
+            aes_ctr_increment(hi, lo);
+        }
+        for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+            b[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(counters+16*j)), rk[0]);
+        }
+        for (unsigned int r=1; r<n_rnd; r++) {
+            for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+                b[j] = _mm_aesenc_si128(b[j], rk[r]);
+            }
+        }
+        for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+            b[j] = _mm_aesenclast_si128(b[j], rk[n_rnd]);
+            b[j] = _mm_xor_si128(b[j], _mm_loadu_si128((const __m128i*)(in+16*j)));
+            _mm_storeu_si128((__m128i*)(out+16*j), b[j]);
+        }
+        in      += 16*AES_PARALLEL_BLOCKS;
+        out     += 16*AES_PARALLEL_BLOCKS;
+        in_size -= 16*AES_PARALLEL_BLOCKS;
+    }
+    while (in_size) {
+        aes_ctr_store(counters, hi, lo);
+        aes_ctr_increment(hi, lo);
+        __m128i b = aesni_enc_blk(_mm_loadu_si128((const __m128i*)counters), rk, n_rnd);
+        if (in_size >= 16) {
+            b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i*)in));
+            _mm_storeu_si128((__m128i*)out, b);
+            in      += 16;
+            out     += 16;
+            in_size -= 16;
+        } else {
+            AP4_UI08 block[16];
+            _mm_storeu_si128((__m128i*)block, b);
+            for (unsigned int j=0; j<in_size; j++) {
+                out[j] = in[j]^block[j];
+            }
+            in_size = 0;
+        }
+    }
+}
+#endif // AES_HWA_HAVE_AESNI
+
+#if defined(AES_HWA_HAVE_ARMV8)
+/*----------------------------------------------------------------------
+|   ARMv8 Crypto Extensions backend
++---------------------------------------------------------------------*/
+#if defined(_MSC_VER)
+#define AES_ARMV8_TARGET
+#elif defined(__clang__)
+#define AES_ARMV8_TARGET __attribute__((target("aes")))
+#else
+#define AES_ARMV8_TARGET __attribute__((target("+crypto")))
+#endif
+
+#if defined(__linux__) && !defined(HWCAP_AES)
+#define HWCAP_AES (1<<3)
+#endif
+
+static bool armv8_aes_supported()
+{
+#if defined(_MSC_VER)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != 0;
+#elif defined(__APPLE__)
+    // all 64-bit Apple silicon implements the AES instructions
+    return true;
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+    return false;
+#endif
+}
+
+AES_ARMV8_TARGET
+static void armv8_load_schedule(const aes_ctx* cx, uint8x16_t rk[15])
+{
+    const AP4_UI08* k = (const AP4_UI08*)cx->k_sch;
+    for (unsigned int i=0; i<=cx->n_rnd; i++) {
+        rk[i] = vld1q_u8(k+16*i);
+    }
+}
+
+/*  AESE/AESD xor the round key *before* the (inverse) SubBytes/ShiftRows
+    step, so compared to the x86 instructions the key additions are shifted
+    by one round: the last round key is xored at the end of encryption,
+    and the first round key at the end of decryption.
+*/
+AES_ARMV8_TARGET
+static inline uint8x16_t armv8_enc_blk(uint8x16_t b, const uint8x16_t rk[15], unsigned int n_rnd)
+{
+    for (unsigned int r=0; r<n_rnd-1; r++) {
+        b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+    }
+    b = vaeseq_u8(b, rk[n_rnd-1]);
+    return veorq_u8(b, rk[n_rnd]);
+}
+
+AES_ARMV8_TARGET
+static inline uint8x16_t armv8_dec_blk(uint8x16_t b, const uint8x16_t rk[15], unsigned int n_rnd)
+{
+    for (unsigned int r=n_rnd; r>1; r--) {
+        b = vaesimcq_u8(vaesdq_u8(b, rk[r]));
+    }
+    b = vaesdq_u8(b, rk[1]);
+    return veorq_u8(b, rk[0]);
+}
+
+AES_ARMV8_TARGET
+static void armv8_cbc_encrypt(const aes_ctx*  cx,
+                              const AP4_UI08* in,
+                              AP4_UI08*       out,
+                              unsigned int    block_count,
+                              const AP4_UI08* chaining_block)
+{
+    uint8x16_t rk[15];
+    armv8_load_schedule(cx, rk);
+
+    uint8x16_t chain = vld1q_u8(chaining_block);
+    for (unsigned int i=0; i<block_count; i++) {
+        chain = armv8_enc_blk(veorq_u8(vld1q_u8(in+16*i), chain), rk, cx->n_rnd);
+        vst1q_u8(out+16*i, chain);
+    }
+}
+
+AES_ARMV8_TARGET
+static void armv8_cbc_decrypt(const aes_ctx*  cx,
+                              const AP4_UI08* in,
+                              AP4_UI08*       out,
+                              unsigned int    block_count,
+                              const AP4_UI08* chaining_block)
+{
+    uint8x16_t rk[15];
+    armv8_load_schedule(cx, rk);
+    unsigned int n_rnd = cx->n_rnd;
+
+    uint8x16_t chain = vld1q_u8(chaining_block);
+    while (block_count >= AES_PARALLEL_BLOCKS) {
+        uint8x16_t c[AES_PARALLEL_BLOCKS];
+        uint8x16_t b[AES_PARALLEL_BLOCKS];
+        for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+            b[j] = c[j] = vld1q_u8(in+16*j);
+        }
+        for (unsigned int r=n_rnd; r>1; r--) {
+            for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+                b[j] = vaesimcq_u8(vaesdq_u8(b[j], rk[r]));
+            }
+        }
+        for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+            b[j] = veorq_u8(vaesdq_u8(b[j], rk[1]), rk[0]);
+            b[j] = veorq_u8(b[j], j?c[j-1]:chain);
+            vst1q_u8(out+16*j, b[j]);
+        }
+        chain = c[AES_PARALLEL_BLOCKS-1];
+        in          += 16*AES_PARALLEL_BLOCKS;
+        out         += 16*AES_PARALLEL_BLOCKS;
+        block_count -= AES_PARALLEL_BLOCKS;
+    }
+    for (; block_count; block_count--) {
+        uint8x16_t c = vld1q_u8(in);
+        vst1q_u8(out, veorq_u8(armv8_dec_blk(c, rk, n_rnd), chain));
+        chain = c;
+        in  += 16;
+        out += 16;
+    }
+}
+
+AES_ARMV8_TARGET
+static void armv8_ctr_process(const aes_ctx*  cx,
+                              const AP4_UI08* in,
+                              AP4_Size        in_size,
+                              AP4_UI08*       out,
+                              const AP4_UI08* counter)
+{
+    uint8x16_t rk[15];
+    armv8_load_schedule(cx, rk);
+    unsigned int n_rnd = cx->n_rnd;
+
+    AP4_UI64 hi, lo;
+    aes_ctr_load(counter, hi, lo);
+
+    AP4_UI08 counters[16*AES_PARALLEL_BLOCKS];
+    while (in_size >= 16*AES_PARALLEL_BLOCKS) {
+        uint8x16_t b[AES_PARALLEL_BLOCKS];
+        for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+            aes_ctr_store(counters+16*j, hi, lo);
+            aes_ctr_increment(hi, lo);
+            b[j] = vld1q_u8(counters+16*j);
+        }
+        for (unsigned int r=0; r<n_rnd-1; r++) {
+            for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+                b[j] = vaesmcq_u8(vaeseq_u8(b[j], rk[r]));
+            }
+        }
+        for (unsigned int j=0; j<AES_PARALLEL_BLOCKS; j++) {
+            b[j] = veorq_u8(vaeseq_u8(b[j], rk[n_rnd-1]), rk[n_rnd]);
+            vst1q_u8(out+16*j, veorq_u8(b[j], vld1q_u8(in+16*j)));
+        }
+        in      += 16*AES_PARALLEL_BLOCKS;
+        out     += 16*AES_PARALLEL_BLOCKS;
+        in_size -= 16*AES_PARALLEL_BLOCKS;
+    }
+    while (in_size) {
+        aes_ctr_store(counters, hi, lo);
+        aes_ctr_increment(hi, lo);
+        uint8x16_t b = armv8_enc_blk(vld1q_u8(counters), rk, n_rnd);
+        if (in_size >= 16) {
+            vst1q_u8(out, veorq_u8(b, vld1q_u8(in)));
+            in      += 16;
+            out     += 16;
+            in_size -= 16;
+        } else {
+            AP4_UI08 block[16];
+            vst1q_u8(block, b);
+            for (unsigned int j=0; j<in_size; j++) {
+                out[j] = in[j]^block[j];
+            }
+            in_size = 0;
+        }
+    }
+}
+#endif // AES_HWA_HAVE_ARMV8
+
+/*----------------------------------------------------------------------
+|   aes_hwa_select
++---------------------------------------------------------------------*/
+static aes_32t aes_hwa_select()
+{
+    if (AP4_GlobalOptions::GetBool("crypto.aes.disable-hardware")) {
+        return AES_HWA_NONE;
+    }
+#if defined(AES_HWA_HAVE_AESNI)
+    if (aesni_supported()) return AES_HWA_AESNI;
+#endif
+#if defined(AES_HWA_HAVE_ARMV8)
+    if (armv8_aes_supported()) return AES_HWA_ARMV8;
+#endif
+    return AES_HWA_NONE;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_AesCbcBlockCipher
 +---------------------------------------------------------------------*/
@@ -1870,6 +2337,26 @@ AP4_AesCbcBlockCipher::Process(const AP4_UI08* input,
 
     // process all blocks
     unsigned int block_count = input_size/AP4_AES_BLOCK_SIZE;
+#if defined(AES_HWA_HAVE_AESNI)
+    if (m_Context->n_hwa == AES_HWA_AESNI) {
+        if (m_Direction == ENCRYPT) {
+            aesni_cbc_encrypt(m_Context, input, output, block_count, chaining_block);
+        } else {
+            aesni_cbc_decrypt(m_Context, input, output, block_count, chaining_block);
+        }
+        return AP4_SUCCESS;
+    }
+#endif
+#if defined(AES_HWA_HAVE_ARMV8)
+    if (m_Context->n_hwa == AES_HWA_ARMV8) {
+        if (m_Direction == ENCRYPT) {
+            armv8_cbc_encrypt(m_Context, input, output, block_count, chaining_block);
+        } else {
+            armv8_cbc_decrypt(m_Context, input, output, block_count, chaining_block);
+        }
+        return AP4_SUCCESS;
+    }
+#endif
     if (m_Direction == ENCRYPT) {
         for (unsigned int i=0; i<block_count; i++) {
             AP4_UI08 block[AP4_AES_BLOCK_SIZE];
@@ -1882,14 +2369,29 @@ AP4_AesCbcBlockCipher::Process(const AP4_UI08* input,
             output += AP4_AES_BLOCK_SIZE;
         }
     } else {
-        for (unsigned int i=0; i<block_count; i++) {
-            aes_dec_blk(input, output, m_Context);
-            for (unsigned int j=0; j<AP4_AES_BLOCK_SIZE; j++) {
-                output[j] ^= chaining_block[j];
+        // the blocks of a group do not depend on each other, so their
+        // decryptions can overlap in the CPU pipeline. The chaining xor is
+        // done last, from the end of the group, so that in-place operation
+        // never overwrites a ciphertext block that is still needed.
+        AP4_UI08 blocks[AES_PARALLEL_BLOCKS*AP4_AES_BLOCK_SIZE];
+        while (block_count) {
+            unsigned int group = block_count < AES_PARALLEL_BLOCKS ? block_count : AES_PARALLEL_BLOCKS;
+            for (unsigned int i=0; i<group; i++) {
+                aes_dec_blk(input+i*AP4_AES_BLOCK_SIZE, blocks+i*AP4_AES_BLOCK_SIZE, m_Context);
             }
-            AP4_CopyMemory(chaining_block, input, AP4_AES_BLOCK_SIZE);
-            input  += AP4_AES_BLOCK_SIZE;
-            output += AP4_AES_BLOCK_SIZE;
+            AP4_UI08 next_chaining_block[AP4_AES_BLOCK_SIZE];
+            AP4_CopyMemory(next_chaining_block, input+(group-1)*AP4_AES_BLOCK_SIZE, AP4_AES_BLOCK_SIZE);
+            for (unsigned int i=group-1; i; i--) {
+                aes_xor(output+i*AP4_AES_BLOCK_SIZE,
+                        blocks+i*AP4_AES_BLOCK_SIZE,
+                        input+(i-1)*AP4_AES_BLOCK_SIZE,
+                        AP4_AES_BLOCK_SIZE);
+            }
+            aes_xor(output, blocks, chaining_block, AP4_AES_BLOCK_SIZE);
+            AP4_CopyMemory(chaining_block, next_chaining_block, AP4_AES_BLOCK_SIZE);
+            input       += group*AP4_AES_BLOCK_SIZE;
+            output      += group*AP4_AES_BLOCK_SIZE;
+            block_count -= group;
         }
     }
 
@@ -1935,31 +2437,38 @@ AP4_AesCtrBlockCipher::Process(const AP4_UI08* input,
         AP4_SetMemory(counter, 0, AP4_AES_BLOCK_SIZE);
     }
 
-    // process all blocks
+#if defined(AES_HWA_HAVE_AESNI)
+    if (m_Context->n_hwa == AES_HWA_AESNI) {
+        aesni_ctr_process(m_Context, input, input_size, output, counter);
+        return AP4_SUCCESS;
+    }
+#endif
+#if defined(AES_HWA_HAVE_ARMV8)
+    if (m_Context->n_hwa == AES_HWA_ARMV8) {
+        armv8_ctr_process(m_Context, input, input_size, output, counter);
+        return AP4_SUCCESS;
+    }
+#endif
+
+    // process the blocks in batches: compute the counters, encrypt them all,
+    // and xor the keystream with the input a word at a time
+    AP4_UI64 counter_hi, counter_lo;
+    aes_ctr_load(counter, counter_hi, counter_lo);
+    AP4_UI08 keystream[AES_PARALLEL_BLOCKS*AP4_AES_BLOCK_SIZE];
     while (input_size) {
-        AP4_UI08 block[AP4_AES_BLOCK_SIZE];
-        aes_enc_blk(counter, block, m_Context);
-        unsigned int chunk = input_size>=AP4_AES_BLOCK_SIZE?AP4_AES_BLOCK_SIZE:input_size;
-        for (unsigned int j=0; j<chunk; j++) {
-            output[j] = input[j]^block[j];
+        unsigned int chunk = input_size>=sizeof(keystream)?(unsigned int)sizeof(keystream):input_size;
+        unsigned int block_count = (chunk+AP4_AES_BLOCK_SIZE-1)/AP4_AES_BLOCK_SIZE;
+        for (unsigned int i=0; i<block_count; i++) {
+            aes_ctr_store(keystream+i*AP4_AES_BLOCK_SIZE, counter_hi, counter_lo);
+            aes_ctr_increment(counter_hi, counter_lo);
         }
-        input_size -= chunk;
-        if (input_size) {
-            // increment the counter
-            for (int x=AP4_AES_BLOCK_SIZE-1; x; --x) {
-                if (counter[x] == 255) {
-                    counter[x] = 0;
-                    continue;
-                } else {
-                    ++counter[x];
-                    break;
-                }
-            }
-
-            // move to the next block
-            input  += AP4_AES_BLOCK_SIZE;
-            output += AP4_AES_BLOCK_SIZE;
+        for (unsigned int i=0; i<block_count; i++) {
+            aes_enc_blk(keystream+i*AP4_AES_BLOCK_SIZE, keystream+i*AP4_AES_BLOCK_SIZE, m_Context);
         }
+        aes_xor(output, input, keystream, chunk);
+        input      += chunk;
+        output     += chunk;
+        input_size -= chunk;
     }
     return AP4_SUCCESS;
 }
@@ -2000,12 +2509,25 @@ AP4_AesBlockCipher::Create(const AP4_UI08*      key,
         }
 
         default:
+            delete context;
             return AP4_ERROR_INVALID_PARAMETERS;
     }
 
+    // use the hardware, when available
+    context->n_hwa = aes_hwa_select();
+
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_AesBlockCipher::IsHardwareAccelerated
++---------------------------------------------------------------------*/
+bool
+AP4_AesBlockCipher::IsHardwareAccelerated()
+{
+    return m_Context->n_hwa != AES_HWA_NONE;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_AesBlockCipher::~AP4_AesBlockCipher
 +---------------------------------------------------------------------*/
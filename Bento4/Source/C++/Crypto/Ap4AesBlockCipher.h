@@ -39,6 +39,9 @@ public:
     virtual ~AP4_AesBlockCipher();
 
     virtual CipherDirection GetDirection() { return m_Direction; }
+
+    // returns true if this cipher uses the CPU's AES instructions
+    bool IsHardwareAccelerated();
     
 protected:
     // constructor
@@ -102,8 +102,20 @@ void
 AP4_CtrStreamCipher::ComputeCounter(AP4_UI64 stream_offset, 
                                     AP4_UI08 counter_block[AP4_CIPHER_BLOCK_SIZE])
 {
-    // setup counter offset bytes
     AP4_UI64 counter_offset = stream_offset/AP4_CIPHER_BLOCK_SIZE;
+
+    // common cases: 64 or 128 bit counters, computed as 64-bit words
+    if (m_CounterSize == 8 || m_CounterSize == 16) {
+        AP4_UI64 iv_hi = AP4_BytesToUInt64BE(m_IV);
+        AP4_UI64 iv_lo = AP4_BytesToUInt64BE(m_IV+8);
+        AP4_UI64 lo = iv_lo+counter_offset;
+        if (m_CounterSize == 16 && lo < iv_lo) ++iv_hi;
+        AP4_BytesFromUInt64BE(counter_block,   iv_hi);
+        AP4_BytesFromUInt64BE(counter_block+8, lo);
+        return;
+    }
+
+    // setup counter offset bytes
     AP4_UI08 counter_offset_bytes[8];
     AP4_BytesFromUInt64BE(counter_offset_bytes, counter_offset);
     
@@ -455,12 +467,15 @@ AP4_CbcStreamCipher::DecryptBuffer(const AP4_UI08* in,
     AP4_ASSERT(m_InBlockFullness == 0);
     AP4_ASSERT(m_OutputSkip == 0);
     
-    // process full blocks
+    // process full blocks (the next chain block is saved first, because the
+    // input may be overwritten when operating in place)
     unsigned int block_count = in_size/AP4_CIPHER_BLOCK_SIZE;
     if (block_count) {
         AP4_UI32 blocks_size = block_count*AP4_CIPHER_BLOCK_SIZE;
+        AP4_UI08 next_chain_block[AP4_CIPHER_BLOCK_SIZE];
+        AP4_CopyMemory(next_chain_block, in+blocks_size-AP4_CIPHER_BLOCK_SIZE, AP4_CIPHER_BLOCK_SIZE);
         AP4_Result result = m_BlockCipher->Process(in, blocks_size, out, m_ChainBlock);
-        AP4_CopyMemory(m_ChainBlock, in+blocks_size-AP4_CIPHER_BLOCK_SIZE, AP4_CIPHER_BLOCK_SIZE);
+        AP4_CopyMemory(m_ChainBlock, next_chain_block, AP4_CIPHER_BLOCK_SIZE);
         if (AP4_FAILED(result)) {
             *out_size = 0;
             return result;
@@ -552,7 +567,40 @@ AP4_PatternStreamCipher::SetStreamOffset(AP4_UI64      /*offset*/,
 }
 
 /*----------------------------------------------------------------------
-|   AP4_PatternStreamCipher
+|   AP4_PatternStreamCipher::NextRun
++---------------------------------------------------------------------*/
+void
+AP4_PatternStreamCipher::NextRun(unsigned int& pattern_position,
+                                 AP4_Size      remain,
+                                 AP4_Size&     crypt_size,
+                                 AP4_Size&     skip_size)
+{
+    unsigned int pattern_span = m_CryptByteBlock+m_SkipByteBlock;
+    crypt_size = 0;
+    skip_size  = m_SkipByteBlock*16;
+    if (pattern_position < m_CryptByteBlock) {
+        // in the encrypted part
+        crypt_size = (m_CryptByteBlock-pattern_position)*16;
+    } else {
+        // in the skipped part
+        skip_size = (pattern_span-pattern_position)*16;
+    }
+    
+    // clip
+    if (crypt_size > remain) {
+        crypt_size = 16*(remain/16);
+        skip_size  = remain-crypt_size;
+    }
+    if (crypt_size+skip_size > remain) {
+        skip_size = remain-crypt_size;
+    }
+    
+    // the next run starts at the beginning of a pattern
+    pattern_position = 0;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_PatternStreamCipher::ProcessBuffer
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_PatternStreamCipher::ProcessBuffer(const AP4_UI08* in,
@@ -570,59 +618,53 @@ AP4_PatternStreamCipher::ProcessBuffer(const AP4_UI08* in,
     // compute where we are in the pattern
     unsigned int pattern_span     = m_CryptByteBlock+m_SkipByteBlock;
     unsigned int block_position   = (unsigned int)(m_StreamOffset/16);
-    unsigned int pattern_position = block_position % pattern_span;
-
-    // process the range
-    while (*out_size < in_size) {
-        unsigned int crypt_size = 0;
-        unsigned int skip_size  = m_SkipByteBlock*16;
-        if (pattern_position < m_CryptByteBlock) {
-            // in the encrypted part
-            crypt_size = (m_CryptByteBlock-pattern_position)*16;
-        } else {
-            // in the skipped part
-            skip_size = (pattern_span-pattern_position)*16;
-        }
-        
-        // clip
-        AP4_Size remain = in_size-*out_size;
-        if (crypt_size > remain) {
-            crypt_size = 16*(remain/16);
-            skip_size  = remain-crypt_size;
-        }
-        if (crypt_size+skip_size > remain) {
-            skip_size = remain-crypt_size;
-        }
-        
-        // encrypted part
-        if (crypt_size) {
-            AP4_Size in_chunk_size  = crypt_size;
-            AP4_Size out_chunk_size = crypt_size;
-            
-            AP4_Result result = m_Cipher->ProcessBuffer(in, in_chunk_size, out, &out_chunk_size);
-            if (AP4_FAILED(result)) return result;
-            // check that we got back what we expectected
-            if (out_chunk_size != in_chunk_size) {
-                return AP4_ERROR_INTERNAL;
-            }
-            in             += crypt_size;
-            out            += crypt_size;
-            *out_size      += crypt_size;
-            m_StreamOffset += crypt_size;
+    unsigned int start_position   = block_position % pattern_span;
+
+    // gather the encrypted blocks of the whole range, so that they can be
+    // processed with a single call to the underlying cipher, which can then
+    // decrypt several blocks at once instead of one or a few per run (the
+    // cipher state only ever sees the encrypted blocks, so this is
+    // equivalent to processing each run separately)
+    AP4_Result result = m_CryptBlocks.SetDataSize(in_size);
+    if (AP4_FAILED(result)) return result;
+    AP4_UI08*    crypt_blocks     = m_CryptBlocks.UseData();
+    AP4_Size     crypt_total      = 0;
+    unsigned int pattern_position = start_position;
+    for (AP4_Size offset = 0; offset < in_size;) {
+        AP4_Size crypt_size, skip_size;
+        NextRun(pattern_position, in_size-offset, crypt_size, skip_size);
+        AP4_CopyMemory(crypt_blocks+crypt_total, in+offset, crypt_size);
+        crypt_total += crypt_size;
+        offset      += crypt_size+skip_size;
+    }
+    if (crypt_total) {
+        AP4_Size crypt_out_size = crypt_total;
+        result = m_Cipher->ProcessBuffer(crypt_blocks, crypt_total, crypt_blocks, &crypt_out_size);
+        if (AP4_FAILED(result)) return result;
+        // check that we got back what we expectected
+        if (crypt_out_size != crypt_total) {
+            return AP4_ERROR_INTERNAL;
         }
-        
-        // skipped part
-        if (skip_size) {
-            AP4_CopyMemory(out, in, skip_size);
-            in             += skip_size;
-            out            += skip_size;
-            *out_size      += skip_size;
-            m_StreamOffset += skip_size;
+    }
+
+    // scatter the processed blocks, and copy the skipped parts, which pass
+    // through unchanged, when not operating in place
+    crypt_total      = 0;
+    pattern_position = start_position;
+    for (AP4_Size offset = 0; offset < in_size;) {
+        AP4_Size crypt_size, skip_size;
+        NextRun(pattern_position, in_size-offset, crypt_size, skip_size);
+        AP4_CopyMemory(out+offset, crypt_blocks+crypt_total, crypt_size);
+        crypt_total += crypt_size;
+        offset      += crypt_size;
+        if (out != in) {
+            AP4_CopyMemory(out+offset, in+offset, skip_size);
         }
-        
-        // we're now at the start of a new pattern
-        pattern_position = 0;
+        offset      += skip_size;
     }
+    
+    *out_size       = in_size;
+    m_StreamOffset += in_size;
 
     return AP4_SUCCESS;
 }
@@ -193,11 +193,18 @@ public:
     virtual const AP4_UI08* GetIV();
 
 private:
+    // methods
+    void NextRun(unsigned int& pattern_position,
+                 AP4_Size      remain,
+                 AP4_Size&     crypt_size,
+                 AP4_Size&     skip_size);
+
     // members
     AP4_StreamCipher* m_Cipher;
     AP4_UI08          m_CryptByteBlock;
     AP4_UI08          m_SkipByteBlock;
     AP4_UI64          m_StreamOffset;
+    AP4_DataBuffer    m_CryptBlocks;
 };
 
 #endif // _AP4_STREAM_CIPHER_H_
@@ -301,6 +301,20 @@ AP4_FileByteStream::Create(const char*              name,
     return AP4_AndroidFileByteStream::Create(NULL, name, mode, stream);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::Create
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MmapFileByteStream::Create(const char*                    /* name */,
+                               AP4_MmapFileByteStream::Access /* access */,
+                               AP4_ByteStream*&               stream)
+{
+    // files are not mapped on this platform, callers fall back to
+    // AP4_FileByteStream
+    stream = NULL;
+    return AP4_ERROR_NOT_SUPPORTED;
+}
+
 #if !defined(AP4_CONFIG_NO_EXCEPTIONS)
 /*----------------------------------------------------------------------
 |   AP4_FileByteStream::AP4_FileByteStream
@@ -43,6 +43,12 @@
 #include <io.h>
 #include <fcntl.h>
 #endif
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
 #include "Ap4FileByteStream.h"
 
 /*----------------------------------------------------------------------
@@ -161,6 +167,13 @@ AP4_fopen_s_utf8(FILE** file, const char* path, const char* mode)
 
 #endif /* _WIN32 */
 
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+#if defined(__linux__)
+const int AP4_STDC_FILE_BYTE_STREAM_MAX_WRITE_VECTORS = 64;
+#endif
+
 /*----------------------------------------------------------------------
 |   AP4_StdcFileByteStream
 +---------------------------------------------------------------------*/
@@ -187,6 +200,9 @@ public:
     AP4_Result WritePartial(const void* buffer, 
                             AP4_Size    bytesToWrite, 
                             AP4_Size&   bytesWritten);
+#if defined(__linux__)
+    AP4_Result WriteBuffers(const Buffer* buffers, unsigned int bufferCount);
+#endif
     AP4_Result Seek(AP4_Position position);
     AP4_Result Tell(AP4_Position& position);
     AP4_Result GetSize(AP4_LargeSize& size);
@@ -379,6 +395,63 @@ AP4_StdcFileByteStream::WritePartial(const void* buffer,
     }
 }
 
+#if defined(__linux__)
+/*----------------------------------------------------------------------
+|   AP4_StdcFileByteStream::WriteBuffers
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_StdcFileByteStream::WriteBuffers(const Buffer* buffers, unsigned int bufferCount)
+{
+    // write what stdio still holds, then hand the buffers straight to the kernel
+    if (fflush(m_File) != 0) return AP4_ERROR_WRITE_FAILED;
+    int fd = fileno(m_File);
+
+    unsigned int next   = 0; // first buffer not completely written
+    AP4_Size     offset = 0; // bytes of that buffer already written
+    for (;;) {
+        // skip what has been written
+        while (next < bufferCount && offset >= buffers[next].m_Size) {
+            offset = 0;
+            ++next;
+        }
+        if (next == bufferCount) break;
+
+        // write as many of the remaining buffers as possible at once
+        struct iovec vectors[AP4_STDC_FILE_BYTE_STREAM_MAX_WRITE_VECTORS];
+        int vectorCount = 0;
+        for (unsigned int i=next; i<bufferCount && vectorCount<AP4_STDC_FILE_BYTE_STREAM_MAX_WRITE_VECTORS; i++) {
+            AP4_Size skip = (i == next) ? offset : 0;
+            if (buffers[i].m_Size == skip) continue;
+            vectors[vectorCount].iov_base = (void*)((const AP4_UI08*)buffers[i].m_Data+skip);
+            vectors[vectorCount].iov_len  = buffers[i].m_Size-skip;
+            ++vectorCount;
+        }
+        ssize_t nbWritten = writev(fd, vectors, vectorCount);
+        if (nbWritten < 0 && errno == EINTR) continue;
+        if (nbWritten <= 0) return AP4_ERROR_WRITE_FAILED;
+        m_Position += nbWritten;
+        if (m_Position > m_Size) {
+            m_Size = m_Position;
+        }
+
+        // advance over the buffers that were written
+        AP4_UI64 remaining = (AP4_UI64)nbWritten;
+        while (remaining) {
+            AP4_Size available = buffers[next].m_Size-offset;
+            if (remaining < available) {
+                offset += (AP4_Size)remaining;
+                break;
+            }
+            remaining -= available;
+            offset = 0;
+            ++next;
+        }
+    }
+
+    return AP4_SUCCESS;
+}
+#endif
+
 /*----------------------------------------------------------------------
 |   AP4_StdcFileByteStream::Seek
 +---------------------------------------------------------------------*/
@@ -439,6 +512,218 @@ AP4_FileByteStream::Create(const char*              name,
     return AP4_StdcFileByteStream::Create(NULL, name, mode, stream);
 }
 
+#if defined(__linux__)
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream
++---------------------------------------------------------------------*/
+class AP4_LinuxMmapFileByteStream: public AP4_ByteStream
+{
+public:
+    // methods
+    AP4_LinuxMmapFileByteStream(const AP4_UI08* data, AP4_LargeSize size);
+    ~AP4_LinuxMmapFileByteStream();
+
+    // AP4_ByteStream methods
+    AP4_Result ReadPartial(void*     buffer, 
+                           AP4_Size  bytesToRead, 
+                           AP4_Size& bytesRead);
+    AP4_Result WritePartial(const void* buffer, 
+                            AP4_Size    bytesToWrite, 
+                            AP4_Size&   bytesWritten);
+    AP4_Result Seek(AP4_Position position);
+    AP4_Result Tell(AP4_Position& position);
+    AP4_Result GetSize(AP4_LargeSize& size);
+    const AP4_UI08* GetDirectPointer(AP4_Position offset, AP4_Size size);
+
+    // AP4_Referenceable methods
+    void AddReference();
+    void Release();
+
+private:
+    // members
+    AP4_Cardinal    m_ReferenceCount;
+    const AP4_UI08* m_Data;
+    AP4_LargeSize   m_Size;
+    AP4_Position    m_Position;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::AP4_LinuxMmapFileByteStream
++---------------------------------------------------------------------*/
+AP4_LinuxMmapFileByteStream::AP4_LinuxMmapFileByteStream(const AP4_UI08* data,
+                                                         AP4_LargeSize   size) :
+    m_ReferenceCount(1),
+    m_Data(data),
+    m_Size(size),
+    m_Position(0)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::~AP4_LinuxMmapFileByteStream
++---------------------------------------------------------------------*/
+AP4_LinuxMmapFileByteStream::~AP4_LinuxMmapFileByteStream()
+{
+    munmap((void*)m_Data, (size_t)m_Size);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::AddReference
++---------------------------------------------------------------------*/
+void
+AP4_LinuxMmapFileByteStream::AddReference()
+{
+    m_ReferenceCount++;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::Release
++---------------------------------------------------------------------*/
+void
+AP4_LinuxMmapFileByteStream::Release()
+{
+    if (--m_ReferenceCount == 0) {
+        delete this;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::ReadPartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_LinuxMmapFileByteStream::ReadPartial(void*     buffer, 
+                                         AP4_Size  bytesToRead, 
+                                         AP4_Size& bytesRead)
+{
+    bytesRead = 0;
+    if (bytesToRead == 0) return AP4_SUCCESS;
+    if (m_Position >= m_Size) return AP4_ERROR_EOS;
+
+    if (bytesToRead > m_Size-m_Position) {
+        bytesToRead = (AP4_Size)(m_Size-m_Position);
+    }
+    memcpy(buffer, m_Data+m_Position, bytesToRead);
+    m_Position += bytesToRead;
+    bytesRead = bytesToRead;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::WritePartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_LinuxMmapFileByteStream::WritePartial(const void* /* buffer */, 
+                                          AP4_Size    /* bytesToWrite */, 
+                                          AP4_Size&   bytesWritten)
+{
+    // the mapping is read-only
+    bytesWritten = 0;
+    return AP4_ERROR_WRITE_FAILED;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::Seek
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_LinuxMmapFileByteStream::Seek(AP4_Position position)
+{
+    // like fseek, seeking past the end is allowed, reads will then hit EOS
+    m_Position = position;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::Tell
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_LinuxMmapFileByteStream::Tell(AP4_Position& position)
+{
+    position = m_Position;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::GetSize
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_LinuxMmapFileByteStream::GetSize(AP4_LargeSize& size)
+{
+    size = m_Size;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinuxMmapFileByteStream::GetDirectPointer
++---------------------------------------------------------------------*/
+const AP4_UI08*
+AP4_LinuxMmapFileByteStream::GetDirectPointer(AP4_Position offset, AP4_Size size)
+{
+    if (offset > m_Size || size > m_Size-offset) return NULL;
+    return m_Data+offset;
+}
+#endif // defined(__linux__)
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::Create
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MmapFileByteStream::Create(const char*                    name,
+                               AP4_MmapFileByteStream::Access access,
+                               AP4_ByteStream*&               stream)
+{
+    // default value
+    stream = NULL;
+    
+    // check arguments
+    if (name == NULL) return AP4_ERROR_INVALID_PARAMETERS;
+
+#if defined(__linux__)
+    // open the file
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return AP4_ERROR_NO_SUCH_FILE;
+        } else if (errno == EACCES) {
+            return AP4_ERROR_PERMISSION_DENIED;
+        } else {
+            return AP4_ERROR_CANNOT_OPEN_FILE;
+        }
+    }
+
+    // only regular files, that fit in the address space, can be mapped
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0 ||
+        (AP4_UI64)info.st_size != (AP4_UI64)(size_t)info.st_size) {
+        close(fd);
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+
+    // map the file, the mapping stays valid once the file is closed
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return AP4_ERROR_NOT_SUPPORTED;
+    switch (access) {
+      case AP4_MmapFileByteStream::ACCESS_SEQUENTIAL:
+        madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+        break;
+
+      case AP4_MmapFileByteStream::ACCESS_RANDOM:
+        madvise(data, (size_t)info.st_size, MADV_RANDOM);
+        break;
+
+      default:
+        break;
+    }
+
+    stream = new AP4_LinuxMmapFileByteStream((const AP4_UI08*)data, info.st_size);
+    return AP4_SUCCESS;
+#else
+    (void)access;
+    return AP4_ERROR_NOT_SUPPORTED;
+#endif
+}
+
 #if !defined(AP4_CONFIG_NO_EXCEPTIONS)
 /*----------------------------------------------------------------------
 |   AP4_FileByteStream::AP4_FileByteStream
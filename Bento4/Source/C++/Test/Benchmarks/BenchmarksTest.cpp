@@ -42,6 +42,7 @@
 
 #include "Ap4.h"
 #include "Ap4StreamCipher.h"
+#include "../Common/TestMedia.h"
 
 /*----------------------------------------------------------------------
 |   constants
@@ -50,6 +51,10 @@
 #define ENC_IN_BUFFER_SIZE (1024*128)
 #define ENC_OUT_BUFFER_SIZE (ENC_IN_BUFFER_SIZE+32)
 #define SCALE_MB (1024.0f*1024.0f)
+#define SYNTHETIC_SAMPLE_COUNT          300
+#define SYNTHETIC_SAMPLES_PER_FRAGMENT  30
+#define SYNTHETIC_MAX_SAMPLE_SIZE       (1024*32)
+#define SYNTHETIC_TRACK_ID              1 /* the track written by WriteTestMovie */
 
 /*----------------------------------------------------------------------
 |   macros
@@ -59,6 +64,7 @@ if (_select) {                          \
     double before = GetTime();          \
     double after = 0.0;                 \
     double total = 0.0;                 \
+    double samples = 0.0;               \
     printf("%s:", _msg);                \
     fflush(stdout);                     \
     unsigned int i;                     \
@@ -69,7 +75,9 @@ if (_select) {                          \
     double time_diff = after-before;                      \
     double st = total/(_scale);                           \
     double stps = (st/time_diff);                         \
-    printf(" %f " _unit "/s (%f " _unit " in %f seconds, %d iterations)\n", stps, st, time_diff, i); \
+    printf(" %f " _unit "/s (%f " _unit " in %f seconds, %d iterations)", stps, st, time_diff, i); \
+    if (samples > 0.0) printf(", %f samples/s", samples/time_diff); \
+    printf("\n");                                         \
 }
 
 #if defined(WIN32)
@@ -144,7 +152,11 @@ PrintUsage()
            "read-samples-dcf-cbc\n"
            "read-samples-dcf-ctr\n"
            "read-samples-pdcf-cbc\n"
-           "read-samples-pdcf-ctr\n");
+           "read-samples-pdcf-ctr\n"
+           "cenc-sample-decrypt\n"
+           "cbcs-pattern-decrypt\n"
+           "cenc-fragment-process\n"
+           "cenc-file-process\n");
 }
 
 /*----------------------------------------------------------------------
@@ -423,6 +435,70 @@ ReadFile(const char* filename, unsigned int block_size, bool sequential)
     return total_read;
 }
 
+/*----------------------------------------------------------------------
+|   CreateSyntheticMedia
++---------------------------------------------------------------------*/
+static AP4_MemoryByteStream*
+CreateSyntheticMedia(const AP4_UI08* key, const char* kid)
+{
+    // make up the samples, each one a single slice NAL unit of random data
+    AP4_MemoryByteStream* sample_data = new AP4_MemoryByteStream();
+    AP4_Array<AP4_Size>   sample_sizes;
+    srand(0);
+    for (unsigned int i=0; i<SYNTHETIC_SAMPLE_COUNT; i++) {
+        AP4_UI32 sample_size = 1024+(AP4_UI32)(rand()%SYNTHETIC_MAX_SAMPLE_SIZE);
+        bool     sync        = (i%SYNTHETIC_SAMPLES_PER_FRAGMENT) == 0;
+        sample_data->WriteUI32(sample_size-4);
+        sample_data->WriteUI08(sync?0x65:0x41);
+        for (unsigned int j=5; j<sample_size; j++) {
+            sample_data->WriteUI08((AP4_UI08)rand());
+        }
+        sample_sizes.Append(sample_size);
+    }
+    
+    // the media is fragmented, as only fragments are actually encrypted,
+    // so the sample table in the moov is left empty
+    AP4_Array<AP4_DataBuffer> sps;
+    AP4_Array<AP4_DataBuffer> pps;
+    const AP4_UI08 sps_data[] = {0x67, 0x64, 0x00, 0x1f};
+    const AP4_UI08 pps_data[] = {0x68, 0xee, 0x3c, 0x80};
+    sps.Append(AP4_DataBuffer(sps_data, sizeof(sps_data)));
+    pps.Append(AP4_DataBuffer(pps_data, sizeof(pps_data)));
+    AP4_SampleDescription* sample_description = new AP4_AvcSampleDescription(AP4_SAMPLE_FORMAT_AVC1,
+                                                                             1280,
+                                                                             720,
+                                                                             24,
+                                                                             "AVC Coding",
+                                                                             100,
+                                                                             31,
+                                                                             0,
+                                                                             4,
+                                                                             1,
+                                                                             0,
+                                                                             0,
+                                                                             sps,
+                                                                             pps);
+    AP4_MemoryByteStream* clear = new AP4_MemoryByteStream();
+    AP4_Result result = WriteTestMovie(AP4_Track::TYPE_VIDEO,
+                                       sample_description,
+                                       sample_data,
+                                       sample_sizes,
+                                       SYNTHETIC_SAMPLES_PER_FRAGMENT,
+                                       false,
+                                       *clear);
+    sample_data->Release();
+    
+    // encrypt it
+    AP4_MemoryByteStream* encrypted = AP4_SUCCEEDED(result) ? EncryptTestMovie(*clear, key, kid) : NULL;
+    clear->Release();
+    if (encrypted == NULL) {
+        fprintf(stderr, "ERROR: failed to make up synthetic media\n");
+        return NULL;
+    }
+    
+    return encrypted;
+}
+
 /*----------------------------------------------------------------------
 |   main
 +---------------------------------------------------------------------*/
@@ -456,6 +532,10 @@ main(int argc, char** argv)
     bool do_read_samples_dcf_ctr   = false;
     bool do_read_samples_pdcf_cbc  = false;
     bool do_read_samples_pdcf_ctr  = false;
+    bool do_cenc_sample_decrypt    = false;
+    bool do_cbcs_pattern_decrypt   = false;
+    bool do_cenc_fragment_process  = false;
+    bool do_cenc_file_process      = false;
     const char* test_file_read     = "test-bench.mp4";
     const char* test_file_mp4      = "test-bench.mp4";
     const char* test_file_dcf_cbc  = "test-bench.mp4.cbc.odf";
@@ -510,6 +590,14 @@ main(int argc, char** argv)
             do_read_samples_pdcf_cbc = true;
         } else if (!strcmp(arg, "read-samples-pdcf-ctr")) {
             do_read_samples_pdcf_ctr = true;
+        } else if (!strcmp(arg, "cenc-sample-decrypt")) {
+            do_cenc_sample_decrypt = true;
+        } else if (!strcmp(arg, "cbcs-pattern-decrypt")) {
+            do_cbcs_pattern_decrypt = true;
+        } else if (!strcmp(arg, "cenc-fragment-process")) {
+            do_cenc_fragment_process = true;
+        } else if (!strcmp(arg, "cenc-file-process")) {
+            do_cenc_file_process = true;
         } else if (!strncmp(arg, "--test-file-read=", 17)) {
             test_file_read = arg+17;
         } else if (!strncmp(arg, "--test-file-mp4=", 16)) {
@@ -547,6 +635,10 @@ main(int argc, char** argv)
             do_read_samples_dcf_ctr   = true;
             do_read_samples_pdcf_cbc  = true;
             do_read_samples_pdcf_ctr  = true;
+            do_cenc_sample_decrypt    = true;
+            do_cbcs_pattern_decrypt   = true;
+            do_cenc_fragment_process  = true;
+            do_cenc_file_process      = true;
         } else {
             fprintf(stderr, "ERROR: unknown test name (%s)\n", arg);
             return 1;
@@ -577,6 +669,47 @@ main(int argc, char** argv)
     AP4_CbcStreamCipher d_cbc_stream_cipher(d_cbc_block_cipher);
     AP4_CtrStreamCipher ctr_stream_cipher(ctr_block_cipher, 16);
 
+    // a video sample, with a clear slice header in each of its subsamples
+    AP4_DataBuffer cenc_sample_in(megabyte_in, ENC_IN_BUFFER_SIZE);
+    AP4_DataBuffer cenc_sample_out;
+    const unsigned int cenc_subsample_count = 4;
+    AP4_UI16 cenc_bytes_of_cleartext_data[cenc_subsample_count];
+    AP4_UI32 cenc_bytes_of_encrypted_data[cenc_subsample_count];
+    for (unsigned int s=0; s<cenc_subsample_count; s++) {
+        cenc_bytes_of_cleartext_data[s] = 64;
+        cenc_bytes_of_encrypted_data[s] = ENC_IN_BUFFER_SIZE/cenc_subsample_count-64;
+    }
+    AP4_UI08 cenc_iv[16];
+    AP4_SetMemory(cenc_iv, 0, sizeof(cenc_iv));
+    AP4_CencSingleSampleDecrypter* cenc_sample_decrypter = NULL;
+    AP4_CencSingleSampleDecrypter::Create(AP4_CENC_CIPHER_AES_128_CTR, key, 16, 0, 0, NULL, false, cenc_sample_decrypter);
+    AP4_CencSingleSampleDecrypter* cbcs_sample_decrypter = NULL;
+    AP4_CencSingleSampleDecrypter::Create(AP4_CENC_CIPHER_AES_128_CBC, key, 16, 1, 9, NULL, true, cbcs_sample_decrypter);
+
+    // synthetic encrypted media
+    AP4_ProtectionKeyMap synthetic_key_map;
+    synthetic_key_map.SetKey(SYNTHETIC_TRACK_ID, key, 16);
+    AP4_MemoryByteStream* synthetic_file      = NULL;
+    AP4_MemoryByteStream* synthetic_fragments = NULL;
+    AP4_CencDecryptingProcessor synthetic_fragment_processor(&synthetic_key_map);
+    if (do_cenc_fragment_process || do_cenc_file_process) {
+        synthetic_file = CreateSyntheticMedia(key, "000102030405060708090a0b0c0d0e0f");
+        if (synthetic_file == NULL) return 1;
+    }
+    if (do_cenc_fragment_process) {
+        // the fragments are decrypted against the init segment loaded once
+        AP4_Position init_size = 0;
+        synthetic_file->Seek(0);
+        if (AP4_FAILED(synthetic_fragment_processor.LoadInit(*synthetic_file))) {
+            fprintf(stderr, "ERROR: failed to load synthetic init segment\n");
+            return 1;
+        }
+        synthetic_file->Tell(init_size);
+        synthetic_fragments = new AP4_MemoryByteStream(synthetic_file->GetData()+init_size,
+                                                       synthetic_file->GetDataSize()-(AP4_Size)init_size);
+    }
+    AP4_DataBuffer synthetic_output;
+
     BENCH_START("AES CBC Block Encryption", do_aes_cbc_block_encrypt)
     for (unsigned b=0; b<256; b++) {
         e_cbc_block_cipher->Process(blocks_in, blocks_size, blocks_out, NULL);
@@ -617,6 +750,53 @@ main(int argc, char** argv)
     total += ENC_IN_BUFFER_SIZE;
     BENCH_END("MB", SCALE_MB)
 
+    BENCH_START("CENC Sample Decryption", do_cenc_sample_decrypt)
+    AP4_Result result = cenc_sample_decrypter->DecryptSampleData(cenc_sample_in,
+                                                                 cenc_sample_out,
+                                                                 cenc_iv,
+                                                                 cenc_subsample_count,
+                                                                 cenc_bytes_of_cleartext_data,
+                                                                 cenc_bytes_of_encrypted_data);
+    if (AP4_FAILED(result)) fprintf(stderr, "ERROR\n");
+    total += ENC_IN_BUFFER_SIZE;
+    samples += 1;
+    BENCH_END("MB", SCALE_MB)
+
+    BENCH_START("CBCS Pattern Decryption", do_cbcs_pattern_decrypt)
+    AP4_Result result = cbcs_sample_decrypter->DecryptSampleData(cenc_sample_in,
+                                                                 cenc_sample_out,
+                                                                 cenc_iv,
+                                                                 cenc_subsample_count,
+                                                                 cenc_bytes_of_cleartext_data,
+                                                                 cenc_bytes_of_encrypted_data);
+    if (AP4_FAILED(result)) fprintf(stderr, "ERROR\n");
+    total += ENC_IN_BUFFER_SIZE;
+    samples += 1;
+    BENCH_END("MB", SCALE_MB)
+
+    BENCH_START("CENC Fragment Process", do_cenc_fragment_process)
+    synthetic_fragments->Seek(0);
+    synthetic_output.SetDataSize(0);
+    AP4_MemoryByteStream* output = new AP4_MemoryByteStream(synthetic_output);
+    AP4_Result result = synthetic_fragment_processor.ProcessFragments(*synthetic_fragments, *output);
+    output->Release();
+    if (AP4_FAILED(result)) fprintf(stderr, "ERROR\n");
+    total += synthetic_fragments->GetDataSize();
+    samples += SYNTHETIC_SAMPLE_COUNT;
+    BENCH_END("MB", SCALE_MB)
+
+    BENCH_START("CENC File Process", do_cenc_file_process)
+    synthetic_file->Seek(0);
+    synthetic_output.SetDataSize(0);
+    AP4_MemoryByteStream* output = new AP4_MemoryByteStream(synthetic_output);
+    AP4_CencDecryptingProcessor processor(&synthetic_key_map);
+    AP4_Result result = processor.Process(*synthetic_file, *output);
+    output->Release();
+    if (AP4_FAILED(result)) fprintf(stderr, "ERROR\n");
+    total += synthetic_file->GetDataSize();
+    samples += SYNTHETIC_SAMPLE_COUNT;
+    BENCH_END("MB", SCALE_MB)
+
     BENCH_START("Read File Sequential (1 Byte Blocks)", do_read_file_seq_1)
     total += ReadFile(test_file_read, 1, true);
     BENCH_END("MB", SCALE_MB)
@@ -681,5 +861,10 @@ main(int argc, char** argv)
     total += LoadAllSamples(test_file_pdcf_ctr, 16);
     BENCH_END("MB", SCALE_MB)
 
+    delete cenc_sample_decrypter;
+    delete cbcs_sample_decrypter;
+    if (synthetic_fragments) synthetic_fragments->Release();
+    if (synthetic_file) synthetic_file->Release();
+
     return 1;
 }
@@ -0,0 +1,179 @@
+/*****************************************************************
+|
+|    AP4 - Synthetic Media For Tests
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+
+#ifndef _AP4_TEST_MEDIA_H_
+#define _AP4_TEST_MEDIA_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4.h"
+
+/*----------------------------------------------------------------------
+|   WriteTestMovie
++---------------------------------------------------------------------*/
+/**
+ * Write a movie with a single track (track ID 1), made of samples
+ * stored back to back in sample_data (which may be NULL when there are
+ * no samples). When samples_per_fragment is 0, the samples are listed
+ * in the moov. Otherwise the moov has an mvex, and the samples follow
+ * as moof/mdat fragments of samples_per_fragment samples each, indexed
+ * by a sidx when with_sidx is true.
+ */
+inline AP4_Result
+WriteTestMovie(AP4_Track::Type            track_type,
+               AP4_SampleDescription*     sample_description,
+               AP4_ByteStream*            sample_data,
+               const AP4_Array<AP4_Size>& sample_sizes,
+               unsigned int               samples_per_fragment,
+               bool                       with_sidx,
+               AP4_ByteStream&            output)
+{
+    AP4_SyntheticSampleTable* sample_table = new AP4_SyntheticSampleTable();
+    sample_table->AddSampleDescription(sample_description);
+    AP4_Cardinal sample_count = sample_sizes.ItemCount();
+    AP4_Movie*   movie        = new AP4_Movie(1000);
+    AP4_File     file(movie);
+    AP4_UI32     brands[]     = {AP4_FILE_BRAND_ISOM, AP4_FILE_BRAND_MP42};
+    file.SetFileType(AP4_FILE_BRAND_MP42, 1, brands, 2);
+    
+    // without fragments, the samples are all in the sample table
+    if (samples_per_fragment == 0) {
+        AP4_Position offset = 0;
+        for (unsigned int i=0; i<sample_count; i++) {
+            AP4_Result result = sample_table->AddSample(*sample_data, offset, sample_sizes[i], 1, 0, i, 0, true);
+            if (AP4_FAILED(result)) {
+                delete sample_table;
+                return result;
+            }
+            offset += sample_sizes[i];
+        }
+        movie->AddTrack(new AP4_Track(track_type, sample_table, 1, 1000, sample_count, 1000, sample_count, "und", 0, 0));
+        return AP4_FileWriter::Write(file, output);
+    }
+    
+    // with fragments, the sample table is left empty
+    movie->AddTrack(new AP4_Track(track_type, sample_table, 1, 1000, 0, 1000, 0, "und", 0, 0));
+    AP4_ContainerAtom* mvex = new AP4_ContainerAtom(AP4_ATOM_TYPE_MVEX);
+    mvex->AddChild(new AP4_TrexAtom(1, 1, 0, 0, 0));
+    movie->GetMoovAtom()->AddChild(mvex);
+    AP4_Result result = file.GetFileType()->Write(output);
+    if (AP4_FAILED(result)) return result;
+    result = movie->GetMoovAtom()->Write(output);
+    if (AP4_FAILED(result)) return result;
+    
+    // make up the fragments, so that the sidx can refer to them
+    AP4_MemoryByteStream*              fragments = new AP4_MemoryByteStream();
+    AP4_Array<AP4_SidxAtom::Reference> references;
+    AP4_DataBuffer                     payload;
+    AP4_Position                       offset = 0;
+    for (unsigned int first=0; first<sample_count; first += samples_per_fragment) {
+        AP4_Array<AP4_TrunAtom::Entry> entries;
+        AP4_Size                       mdat_size = 0;
+        for (unsigned int i=first; i<first+samples_per_fragment && i<sample_count; i++) {
+            AP4_TrunAtom::Entry entry;
+            entry.sample_size = sample_sizes[i];
+            entries.Append(entry);
+            mdat_size += sample_sizes[i];
+        }
+        AP4_TrunAtom* trun = new AP4_TrunAtom(AP4_TRUN_FLAG_DATA_OFFSET_PRESENT |
+                                              AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT, 0, 0);
+        trun->SetEntries(entries);
+        AP4_ContainerAtom* traf = new AP4_ContainerAtom(AP4_ATOM_TYPE_TRAF);
+        traf->AddChild(new AP4_TfhdAtom(AP4_TFHD_FLAG_DEFAULT_BASE_IS_MOOF |
+                                        AP4_TFHD_FLAG_DEFAULT_SAMPLE_DURATION_PRESENT,
+                                        1, 0, 0, 1, 0, 0));
+        traf->AddChild(new AP4_TfdtAtom(1, first));
+        traf->AddChild(trun);
+        AP4_ContainerAtom moof(AP4_ATOM_TYPE_MOOF);
+        moof.AddChild(new AP4_MfhdAtom(1+first/samples_per_fragment));
+        moof.AddChild(traf);
+        trun->SetDataOffset((AP4_UI32)moof.GetSize()+AP4_ATOM_HEADER_SIZE);
+        
+        payload.SetDataSize(mdat_size);
+        if (mdat_size) {
+            result = sample_data->Seek(offset);
+            if (AP4_SUCCEEDED(result)) result = sample_data->Read(payload.UseData(), mdat_size);
+            if (AP4_FAILED(result)) break;
+        }
+        offset += mdat_size;
+        moof.Write(*fragments);
+        fragments->WriteUI32(AP4_ATOM_HEADER_SIZE+mdat_size);
+        fragments->WriteUI32(AP4_ATOM_TYPE_MDAT);
+        fragments->Write(payload.GetData(), mdat_size);
+        
+        AP4_SidxAtom::Reference reference;
+        reference.m_ReferencedSize     = (AP4_UI32)(moof.GetSize()+AP4_ATOM_HEADER_SIZE+mdat_size);
+        reference.m_SubsegmentDuration = entries.ItemCount();
+        reference.m_StartsWithSap      = true;
+        reference.m_SapType            = 1;
+        references.Append(reference);
+    }
+    if (AP4_SUCCEEDED(result) && with_sidx) {
+        AP4_SidxAtom sidx(1, 1000, 0, 0);
+        sidx.SetReferenceCount(references.ItemCount());
+        for (unsigned int i=0; i<references.ItemCount(); i++) {
+            sidx.SetReference(i, references[i]);
+        }
+        result = sidx.Write(output);
+    }
+    if (AP4_SUCCEEDED(result)) {
+        result = output.Write(fragments->GetData(), fragments->GetDataSize());
+    }
+    fragments->Release();
+    
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   EncryptTestMovie
++---------------------------------------------------------------------*/
+/**
+ * Encrypt track 1 of a movie with MPEG CENC, with a zero IV.
+ * @return A new stream with the encrypted movie, or NULL on failure.
+ */
+inline AP4_MemoryByteStream*
+EncryptTestMovie(AP4_ByteStream& clear, const AP4_UI08* key, const char* kid)
+{
+    AP4_CencEncryptingProcessor processor(AP4_CENC_VARIANT_MPEG_CENC);
+    AP4_UI08 iv[16];
+    AP4_SetMemory(iv, 0, sizeof(iv));
+    processor.GetKeyMap().SetKey(1, key, 16, iv, 16);
+    processor.GetPropertyMap().SetProperty(1, "KID", kid);
+    AP4_MemoryByteStream* encrypted = new AP4_MemoryByteStream();
+    clear.Seek(0);
+    if (AP4_FAILED(processor.Process(clear, *encrypted))) {
+        encrypted->Release();
+        return NULL;
+    }
+    
+    return encrypted;
+}
+
+#endif // _AP4_TEST_MEDIA_H_
@@ -34,6 +34,7 @@
 
 #include "Ap4.h"
 #include "Ap4StreamCipher.h"
+#include "Ap4AesBlockCipher.h"
 #include "Ap4Hmac.h"
 #include "Ap4KeyWrap.h"
 
@@ -2304,6 +2305,464 @@ TestCbcStreamCipher()
     return 0;
 }
 
+/*----------------------------------------------------------------------
+|   TestCtrCounterSizes
++---------------------------------------------------------------------*/
+static int
+TestCtrCounterSizes()
+{
+    AP4_UI08 key[16] = {0};
+    AP4_UI08 zeros[16] = {0};
+    AP4_UI08 iv[16] = {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE
+    };
+    
+    // expected counters at block 3, with 64 and 128 bit counters
+    AP4_UI08 counter_64[16] = {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0xFF,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+    };
+    AP4_UI08 counter_128[16] = {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x08, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+    };
+    AP4_UI08* expected_counters[2] = { counter_64, counter_128 };
+    AP4_Size  counter_sizes[2]     = { 8, 16 };
+    
+    for (unsigned int i=0; i<2; i++) {
+        AP4_BlockCipher* block_cipher = NULL;
+        AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, 
+                                                             AP4_BlockCipher::ENCRYPT,
+                                                             AP4_BlockCipher::CTR,
+                                                             NULL,
+                                                             key, 
+                                                             16, 
+                                                             block_cipher);
+        AP4_UI08 expected[16];
+        CHECK(block_cipher->Process(zeros, 16, expected, expected_counters[i]) == AP4_SUCCESS);
+
+        AP4_CtrStreamCipher cipher(block_cipher, counter_sizes[i]);
+        cipher.SetIV(iv);
+        cipher.SetStreamOffset(3*16);
+        AP4_UI08 out[16];
+        CHECK(cipher.ProcessBuffer(zeros, 16, out) == AP4_SUCCESS);
+        CHECK(BuffersEqual(out, expected, 16));
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestAesBackends
++---------------------------------------------------------------------*/
+static AP4_AesBlockCipher*
+CreateAesCipher(const AP4_UI08*                  key,
+                AP4_BlockCipher::CipherDirection direction,
+                AP4_BlockCipher::CipherMode      mode,
+                bool                             portable)
+{
+    AP4_GlobalOptions::SetBool("crypto.aes.disable-hardware", portable);
+    AP4_AesBlockCipher* cipher = NULL;
+    AP4_AesBlockCipher::Create(key, direction, mode, NULL, cipher);
+    AP4_GlobalOptions::SetBool("crypto.aes.disable-hardware", false);
+    return cipher;
+}
+
+static int
+TestAesBackends()
+{
+    AP4_UI08 key[16];
+    AP4_UI08 iv[16];
+    AP4_UI08 in[1024];
+    AP4_UI08 out_hw[1024];
+    AP4_UI08 out_sw[1024];
+    for (unsigned int i=0; i<sizeof(key); i++) key[i] = (AP4_UI08)rand();
+    for (unsigned int i=0; i<sizeof(iv);  i++) iv[i]  = (AP4_UI08)rand();
+    for (unsigned int i=0; i<sizeof(in);  i++) in[i]  = (AP4_UI08)rand();
+
+    AP4_BlockCipher::CipherDirection directions[2] = {
+        AP4_BlockCipher::ENCRYPT,
+        AP4_BlockCipher::DECRYPT
+    };
+    AP4_BlockCipher::CipherMode modes[2] = {
+        AP4_BlockCipher::CBC,
+        AP4_BlockCipher::CTR
+    };
+    for (unsigned int m=0; m<2; m++) {
+        for (unsigned int d=0; d<2; d++) {
+            AP4_AesBlockCipher* hw = CreateAesCipher(key, directions[d], modes[m], false);
+            AP4_AesBlockCipher* sw = CreateAesCipher(key, directions[d], modes[m], true);
+            CHECK(hw != NULL && sw != NULL);
+            CHECK(!sw->IsHardwareAccelerated());
+            if (m == 0 && d == 0) {
+                printf("AES backend: %s\n", hw->IsHardwareAccelerated()?"hardware":"portable");
+            }
+
+            // sizes around the pipelining boundaries
+            for (unsigned int size=0; size<=sizeof(in); size++) {
+                if (modes[m] == AP4_BlockCipher::CBC && size%16) continue;
+                AP4_Result result = hw->Process(in, size, out_hw, iv);
+                CHECK(result == AP4_SUCCESS);
+                result = sw->Process(in, size, out_sw, iv);
+                CHECK(result == AP4_SUCCESS);
+                CHECK(BuffersEqual(out_hw, out_sw, size));
+
+                // in-place
+                AP4_CopyMemory(out_hw, in, size);
+                result = hw->Process(out_hw, size, out_hw, iv);
+                CHECK(result == AP4_SUCCESS);
+                CHECK(BuffersEqual(out_hw, out_sw, size));
+                AP4_CopyMemory(out_hw, in, size);
+                result = sw->Process(out_hw, size, out_hw, iv);
+                CHECK(result == AP4_SUCCESS);
+                CHECK(BuffersEqual(out_hw, out_sw, size));
+            }
+
+            // counters that carry across the 64-bit halves and wrap around
+            if (modes[m] == AP4_BlockCipher::CTR) {
+                AP4_UI08 counter[16];
+                AP4_CopyMemory(counter, iv, 16);
+                for (unsigned int i=1; i<16; i++) counter[i] = 0xFF;
+                counter[15] = 0xFA;
+                CHECK(hw->Process(in, sizeof(in), out_hw, counter) == AP4_SUCCESS);
+                CHECK(sw->Process(in, sizeof(in), out_sw, counter) == AP4_SUCCESS);
+                CHECK(BuffersEqual(out_hw, out_sw, sizeof(in)));
+                for (unsigned int i=8; i<16; i++) counter[i] = 0xFF;
+                counter[7] = 0x12;
+                CHECK(hw->Process(in, sizeof(in), out_hw, counter) == AP4_SUCCESS);
+                CHECK(sw->Process(in, sizeof(in), out_sw, counter) == AP4_SUCCESS);
+                CHECK(BuffersEqual(out_hw, out_sw, sizeof(in)));
+            }
+
+            delete hw;
+            delete sw;
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestPatternStreamCipher
++---------------------------------------------------------------------*/
+static AP4_StreamCipher*
+CreatePatternSubCipher(const AP4_UI08* key, AP4_BlockCipher::CipherMode mode)
+{
+    AP4_BlockCipher* block_cipher = NULL;
+    AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, 
+                                                         mode == AP4_BlockCipher::CBC ?
+                                                         AP4_BlockCipher::DECRYPT :
+                                                         AP4_BlockCipher::ENCRYPT,
+                                                         mode,
+                                                         NULL,
+                                                         key, 
+                                                         16, 
+                                                         block_cipher);
+    if (mode == AP4_BlockCipher::CBC) {
+        return new AP4_CbcStreamCipher(block_cipher);
+    } else {
+        return new AP4_CtrStreamCipher(block_cipher, 8);
+    }
+}
+
+static int
+TestPatternStreamCipher()
+{
+    AP4_UI08 key[16];
+    AP4_UI08 iv[16];
+    AP4_UI08 in[2048];
+    AP4_UI08 out[2048];
+    AP4_UI08 expected[2048];
+    for (unsigned int i=0; i<sizeof(key); i++) key[i] = (AP4_UI08)rand();
+    for (unsigned int i=0; i<sizeof(iv);  i++) iv[i]  = (AP4_UI08)rand();
+    for (unsigned int i=0; i<sizeof(in);  i++) in[i]  = (AP4_UI08)rand();
+
+    AP4_UI08 patterns[][2] = { {1, 9}, {2, 8}, {5, 5}, {1, 0} };
+    AP4_BlockCipher::CipherMode modes[2] = {
+        AP4_BlockCipher::CBC,
+        AP4_BlockCipher::CTR
+    };
+    for (unsigned int m=0; m<2; m++) {
+        for (unsigned int p=0; p<sizeof(patterns)/sizeof(patterns[0]); p++) {
+            AP4_UI08 crypt_byte_block = patterns[p][0];
+            AP4_UI08 skip_byte_block  = patterns[p][1];
+            AP4_StreamCipher* reference = CreatePatternSubCipher(key, modes[m]);
+            AP4_PatternStreamCipher cipher(CreatePatternSubCipher(key, modes[m]),
+                                           crypt_byte_block,
+                                           skip_byte_block);
+            for (int run=0; run<100; run++) {
+                AP4_Size size = (AP4_Size)(rand()%sizeof(in));
+
+                // reference: one call per encrypted run, skipped runs copied
+                reference->SetIV(iv);
+                for (AP4_Size offset=0; offset<size;) {
+                    AP4_Size crypt_size = 16*crypt_byte_block;
+                    if (crypt_size > size-offset) crypt_size = 16*((size-offset)/16);
+                    if (crypt_size) {
+                        AP4_Size out_size = crypt_size;
+                        CHECK(reference->ProcessBuffer(in+offset, crypt_size, expected+offset, &out_size) == AP4_SUCCESS);
+                        CHECK(out_size == crypt_size);
+                        offset += crypt_size;
+                    }
+                    AP4_Size skip_size = 16*skip_byte_block;
+                    if (skip_size > size-offset || crypt_size == 0) skip_size = size-offset;
+                    AP4_CopyMemory(expected+offset, in+offset, skip_size);
+                    offset += skip_size;
+                }
+
+                // out of place, in one call
+                AP4_Size out_size = 0;
+                cipher.SetIV(iv);
+                CHECK(cipher.ProcessBuffer(in, size, out, &out_size) == AP4_SUCCESS);
+                CHECK(out_size == size);
+                CHECK(BuffersEqual(out, expected, size));
+
+                // in place, in two calls split on a block boundary
+                AP4_Size split = 16*((rand()%(size+1))/16);
+                AP4_CopyMemory(out, in, size);
+                cipher.SetIV(iv);
+                CHECK(cipher.ProcessBuffer(out, split, out, &out_size) == AP4_SUCCESS);
+                CHECK(out_size == split);
+                CHECK(cipher.ProcessBuffer(out+split, size-split, out+split, &out_size) == AP4_SUCCESS);
+                CHECK(out_size == size-split);
+                CHECK(BuffersEqual(out, expected, size));
+            }
+            delete reference;
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   CencSchemes
++---------------------------------------------------------------------*/
+static struct {
+    AP4_UI32 cipher_type;
+    AP4_UI08 crypt_byte_block;
+    AP4_UI08 skip_byte_block;
+    bool     reset_iv_at_each_subsample;
+} CencSchemes[] = {
+    { AP4_CENC_CIPHER_AES_128_CTR, 0, 0, false }, // cenc
+    { AP4_CENC_CIPHER_AES_128_CBC, 0, 0, false }, // cbc1
+    { AP4_CENC_CIPHER_AES_128_CTR, 1, 9, false }, // cens
+    { AP4_CENC_CIPHER_AES_128_CBC, 1, 9, true  }  // cbcs
+};
+static const unsigned int CencSchemeCount = sizeof(CencSchemes)/sizeof(CencSchemes[0]);
+
+/*----------------------------------------------------------------------
+|   MakeCencSample
++---------------------------------------------------------------------*/
+static void
+MakeCencSample(AP4_DataBuffer& sample,
+               unsigned int&   subsample_count,
+               AP4_UI16        bytes_of_cleartext_data[4],
+               AP4_UI32        bytes_of_encrypted_data[4])
+{
+    // random data, with up to 4 subsamples, and a partial block at the end
+    subsample_count = (unsigned int)(rand()%5);
+    AP4_Size sample_size = 0;
+    for (unsigned int i=0; i<subsample_count; i++) {
+        bytes_of_cleartext_data[i] = (AP4_UI16)(rand()%100);
+        bytes_of_encrypted_data[i] = (AP4_UI32)(16*(rand()%64));
+        sample_size += bytes_of_cleartext_data[i]+bytes_of_encrypted_data[i];
+    }
+    sample_size += rand()%(subsample_count?16:1000);
+
+    sample.SetDataSize(sample_size);
+    for (unsigned int i=0; i<sample_size; i++) sample.UseData()[i] = (AP4_UI08)rand();
+}
+
+/*----------------------------------------------------------------------
+|   TestCencInPlaceDecryption
++---------------------------------------------------------------------*/
+static int
+TestCencInPlaceDecryption()
+{
+    AP4_UI08 key[16];
+    AP4_UI08 iv[16];
+    for (unsigned int i=0; i<sizeof(key); i++) key[i] = (AP4_UI08)rand();
+    for (unsigned int i=0; i<sizeof(iv);  i++) iv[i]  = (AP4_UI08)rand();
+
+    for (unsigned int s=0; s<CencSchemeCount; s++) {
+        AP4_CencSingleSampleDecrypter* decrypter = NULL;
+        CHECK(AP4_CencSingleSampleDecrypter::Create(CencSchemes[s].cipher_type,
+                                                    key,
+                                                    16,
+                                                    CencSchemes[s].crypt_byte_block,
+                                                    CencSchemes[s].skip_byte_block,
+                                                    NULL,
+                                                    CencSchemes[s].reset_iv_at_each_subsample,
+                                                    decrypter) == AP4_SUCCESS);
+        for (int run=0; run<100; run++) {
+            AP4_DataBuffer sample;
+            unsigned int   subsample_count;
+            AP4_UI16       bytes_of_cleartext_data[4];
+            AP4_UI32       bytes_of_encrypted_data[4];
+            MakeCencSample(sample, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
+            AP4_Size sample_size = sample.GetDataSize();
+
+            AP4_DataBuffer expected;
+            CHECK(decrypter->DecryptSampleData(sample,
+                                               expected,
+                                               iv,
+                                               subsample_count,
+                                               bytes_of_cleartext_data,
+                                               bytes_of_encrypted_data) == AP4_SUCCESS);
+            CHECK(decrypter->DecryptSampleData(sample,
+                                               sample,
+                                               iv,
+                                               subsample_count,
+                                               bytes_of_cleartext_data,
+                                               bytes_of_encrypted_data) == AP4_SUCCESS);
+            CHECK(sample.GetDataSize() == expected.GetDataSize());
+            CHECK(BuffersEqual(sample.GetData(), expected.GetData(), sample_size));
+        }
+        delete decrypter;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestCencIndexedDecryption
++---------------------------------------------------------------------*/
+static int
+TestCencIndexedDecryption()
+{
+    AP4_UI08 key[16];
+    for (unsigned int i=0; i<sizeof(key); i++) key[i] = (AP4_UI08)rand();
+
+    const unsigned int sample_count = 50;
+    for (unsigned int s=0; s<CencSchemeCount; s++) {
+        // make up some samples, with their IVs and subsamples
+        AP4_CencSampleInfoTable* sample_info_table = new AP4_CencSampleInfoTable(0,
+                                                                                 CencSchemes[s].crypt_byte_block,
+                                                                                 CencSchemes[s].skip_byte_block,
+                                                                                 sample_count,
+                                                                                 16);
+        AP4_DataBuffer samples[sample_count];
+        for (unsigned int i=0; i<sample_count; i++) {
+            AP4_UI08 iv[16];
+            for (unsigned int j=0; j<sizeof(iv); j++) iv[j] = (AP4_UI08)rand();
+            CHECK(sample_info_table->SetIv(i, iv) == AP4_SUCCESS);
+            
+            unsigned int subsample_count;
+            AP4_UI16     bytes_of_cleartext_data[4];
+            AP4_UI32     bytes_of_encrypted_data[4];
+            MakeCencSample(samples[i], subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
+            AP4_UI08 subsample_data[4*6];
+            for (unsigned int j=0; j<subsample_count; j++) {
+                AP4_BytesFromUInt16BE(&subsample_data[j*6],   bytes_of_cleartext_data[j]);
+                AP4_BytesFromUInt32BE(&subsample_data[j*6+2], bytes_of_encrypted_data[j]);
+            }
+            CHECK(sample_info_table->AddSubSampleData(subsample_count, subsample_data) == AP4_SUCCESS);
+        }
+        
+        AP4_CencSampleDecrypter* decrypter = NULL;
+        CHECK(AP4_CencSampleDecrypter::Create(sample_info_table,
+                                              CencSchemes[s].cipher_type,
+                                              key,
+                                              16,
+                                              NULL,
+                                              CencSchemes[s].reset_iv_at_each_subsample,
+                                              decrypter) == AP4_SUCCESS);
+        CHECK(decrypter->CanCreateSingleSampleDecrypter());
+        
+        // decrypt the samples in order, with the sample cursor
+        AP4_DataBuffer expected[sample_count];
+        for (unsigned int i=0; i<sample_count; i++) {
+            CHECK(decrypter->DecryptSampleData(samples[i], expected[i], NULL) == AP4_SUCCESS);
+        }
+        
+        // decrypt them again, in place, backwards, alternating between two
+        // single-sample decrypters, as separate threads would
+        AP4_CencSingleSampleDecrypter* single_sample_decrypters[2] = { NULL, NULL };
+        CHECK(decrypter->CreateSingleSampleDecrypter(single_sample_decrypters[0]) == AP4_SUCCESS);
+        CHECK(decrypter->CreateSingleSampleDecrypter(single_sample_decrypters[1]) == AP4_SUCCESS);
+        for (unsigned int i=sample_count; i--;) {
+            CHECK(decrypter->DecryptSampleData(i, *single_sample_decrypters[i%2], samples[i], samples[i]) == AP4_SUCCESS);
+            CHECK(samples[i].GetDataSize() == expected[i].GetDataSize());
+            CHECK(BuffersEqual(samples[i].GetData(), expected[i].GetData(), samples[i].GetDataSize()));
+        }
+        delete single_sample_decrypters[0];
+        delete single_sample_decrypters[1];
+        delete decrypter;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestProtectionKeyMap
++---------------------------------------------------------------------*/
+static int
+TestProtectionKeyMap()
+{
+    AP4_ProtectionKeyMap key_map;
+    const unsigned int key_count = 5000;
+    AP4_UI08 kid[16];
+    AP4_UI08 key[16];
+    AP4_UI08 zero_kid[16];
+    AP4_SetMemory(zero_kid, 0, 16);
+    
+    // nothing to find in an empty map
+    CHECK(key_map.GetKey(1) == NULL);
+    CHECK(key_map.GetKeyByKid(zero_kid) == NULL);
+    
+    // set keys for many KIDs, and for a few tracks
+    for (unsigned int i=0; i<key_count; i++) {
+        AP4_SetMemory(kid, 0, 16);
+        AP4_BytesFromUInt32BE(&kid[12], i+1);
+        AP4_BytesFromUInt32BE(&key[0], i);
+        AP4_SetMemory(&key[4], 0xAB, 12);
+        CHECK(key_map.SetKeyForKid(kid, key, 16) == AP4_SUCCESS);
+        if (i < 10) CHECK(key_map.SetKey(i+1, key, 16) == AP4_SUCCESS);
+    }
+    
+    // find them all
+    for (unsigned int i=0; i<key_count; i++) {
+        AP4_SetMemory(kid, 0, 16);
+        AP4_BytesFromUInt32BE(&kid[12], i+1);
+        const AP4_DataBuffer* found = key_map.GetKeyByKid(kid);
+        CHECK(found != NULL);
+        CHECK(found->GetDataSize() == 16);
+        CHECK(AP4_BytesToUInt32BE(found->GetData()) == i);
+    }
+    for (unsigned int i=0; i<10; i++) {
+        const AP4_DataBuffer* iv    = NULL;
+        const AP4_DataBuffer* found = NULL;
+        CHECK(key_map.GetKeyAndIv(i+1, found, iv) == AP4_SUCCESS);
+        CHECK(AP4_BytesToUInt32BE(found->GetData()) == i);
+        CHECK(iv != NULL && iv->GetDataSize() == 16);
+    }
+    CHECK(key_map.GetKey(11) == NULL);
+    AP4_SetMemory(kid, 0xFF, 16);
+    CHECK(key_map.GetKeyByKid(kid) == NULL);
+    
+    // entries set by KID have a zero track ID, and entries set by track
+    // have a zero KID: the first ones set are the ones found
+    CHECK(AP4_BytesToUInt32BE(key_map.GetKey(0)->GetData()) == 0);
+    CHECK(AP4_BytesToUInt32BE(key_map.GetKeyByKid(zero_kid)->GetData()) == 0);
+    
+    // setting a key again replaces it
+    AP4_SetMemory(kid, 0, 16);
+    AP4_BytesFromUInt32BE(&kid[12], 1234);
+    AP4_SetMemory(key, 0x11, 16);
+    CHECK(key_map.SetKeyForKid(kid, key, 16) == AP4_SUCCESS);
+    CHECK(BuffersEqual(key_map.GetKeyByKid(kid)->GetData(), key, 16));
+    CHECK(key_map.SetKey(5, key, 16) == AP4_SUCCESS);
+    CHECK(BuffersEqual(key_map.GetKey(5)->GetData(), key, 16));
+    
+    // copied keys are found in the copy
+    AP4_ProtectionKeyMap copy;
+    CHECK(copy.SetKeys(key_map) == AP4_SUCCESS);
+    CHECK(BuffersEqual(copy.GetKey(5)->GetData(), key, 16));
+    
+    return 0;
+}
+
 int
 main(int /*argc*/, char** /*argv*/)
 {
@@ -2323,6 +2782,24 @@ main(int /*argc*/, char** /*argv*/)
 
     result = TestCbcStreamCipher();
     if (result) return result;
+
+    result = TestCtrCounterSizes();
+    if (result) return result;
+
+    result = TestAesBackends();
+    if (result) return result;
+
+    result = TestPatternStreamCipher();
+    if (result) return result;
+
+    result = TestCencInPlaceDecryption();
+    if (result) return result;
+
+    result = TestCencIndexedDecryption();
+    if (result) return result;
+
+    result = TestProtectionKeyMap();
+    if (result) return result;
     
     return 0;
 }
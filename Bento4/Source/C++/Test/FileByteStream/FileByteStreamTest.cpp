@@ -0,0 +1,135 @@
+/*****************************************************************
+|
+|    AP4 - File Byte Stream Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Ap4.h"
+
+/*----------------------------------------------------------------------
+|   BuffersEqual
++---------------------------------------------------------------------*/
+static bool
+BuffersEqual(const unsigned char* a, 
+             const unsigned char* b,
+             AP4_Size             size)
+{
+    for (unsigned int i=0; i<size; i++) {
+        if (a[i]!=b[i]) {
+            fprintf(stderr, "mismatch at %d of %d\n", i, (int)size);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*----------------------------------------------------------------------
+|   CHECK
++---------------------------------------------------------------------*/
+#define CHECK(x) if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); DebugHook(); return -1; }
+
+/*----------------------------------------------------------------------
+|   DebugHook
++---------------------------------------------------------------------*/
+static void
+DebugHook()
+{
+    // put a breakpoint here
+    fprintf(stderr, "Debug Hook\n");
+}
+
+/*----------------------------------------------------------------------
+|   TestMmapFileByteStream
++---------------------------------------------------------------------*/
+static int
+TestMmapFileByteStream()
+{
+    // write a file
+    const char*        filename = "filebytestreamtest-mmap.tmp";
+    const unsigned int size     = 100000;
+    AP4_UI08*          data     = new AP4_UI08[size];
+    for (unsigned int i=0; i<size; i++) data[i] = (AP4_UI08)rand();
+    AP4_ByteStream* output = NULL;
+    CHECK(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_WRITE, output) == AP4_SUCCESS);
+    CHECK(output->Write(data, size) == AP4_SUCCESS);
+    output->Release();
+
+    // map it
+    AP4_ByteStream* input = NULL;
+    AP4_Result result = AP4_MmapFileByteStream::Create(filename, AP4_MmapFileByteStream::ACCESS_RANDOM, input);
+#if defined(__linux__)
+    CHECK(result == AP4_SUCCESS);
+#endif
+    if (AP4_SUCCEEDED(result)) {
+        AP4_LargeSize input_size = 0;
+        CHECK(input->GetSize(input_size) == AP4_SUCCESS);
+        CHECK(input_size == size);
+        AP4_UI08 buffer[1000];
+        CHECK(input->Read(buffer, sizeof(buffer)) == AP4_SUCCESS);
+        CHECK(BuffersEqual(buffer, data, sizeof(buffer)));
+        CHECK(input->Seek(size-10) == AP4_SUCCESS);
+        AP4_Size bytes_read = 0;
+        CHECK(input->ReadPartial(buffer, sizeof(buffer), bytes_read) == AP4_SUCCESS);
+        CHECK(bytes_read == 10);
+        CHECK(BuffersEqual(buffer, data+size-10, 10));
+        AP4_Position position = 0;
+        CHECK(input->Tell(position) == AP4_SUCCESS);
+        CHECK(position == size);
+        CHECK(input->ReadPartial(buffer, sizeof(buffer), bytes_read) == AP4_ERROR_EOS);
+        CHECK(input->Seek(5000) == AP4_SUCCESS);
+        CHECK(input->Read(buffer, sizeof(buffer)) == AP4_SUCCESS);
+        CHECK(BuffersEqual(buffer, data+5000, sizeof(buffer)));
+        CHECK(AP4_FAILED(input->Write(buffer, 1)));
+        input->Release();
+    }
+    remove(filename);
+    delete[] data;
+
+    // files that can't be mapped
+    CHECK(AP4_MmapFileByteStream::Create(filename, AP4_MmapFileByteStream::ACCESS_NORMAL, input) != AP4_SUCCESS);
+    CHECK(input == NULL);
+#if defined(__linux__)
+    CHECK(AP4_MmapFileByteStream::Create("/dev/null", AP4_MmapFileByteStream::ACCESS_NORMAL, input) == AP4_ERROR_NOT_SUPPORTED);
+#endif
+
+    return 0;
+}
+
+int
+main(int /*argc*/, char** /*argv*/)
+{
+    int result;
+    
+    result = TestMmapFileByteStream();
+    if (result) return result;
+    
+    return 0;
+}
@@ -0,0 +1,585 @@
+/*****************************************************************
+|
+|    AP4 - Processor Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Ap4.h"
+#include "../Common/TestMedia.h"
+
+/*----------------------------------------------------------------------
+|   BuffersEqual
++---------------------------------------------------------------------*/
+static bool
+BuffersEqual(const unsigned char* a, 
+             const unsigned char* b,
+             AP4_Size             size)
+{
+    for (unsigned int i=0; i<size; i++) {
+        if (a[i]!=b[i]) {
+            fprintf(stderr, "mismatch at %d of %d\n", i, (int)size);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*----------------------------------------------------------------------
+|   CHECK
++---------------------------------------------------------------------*/
+#define CHECK(x) if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); DebugHook(); return -1; }
+
+/*----------------------------------------------------------------------
+|   DebugHook
++---------------------------------------------------------------------*/
+static void
+DebugHook()
+{
+    // put a breakpoint here
+    fprintf(stderr, "Debug Hook\n");
+}
+
+/*----------------------------------------------------------------------
+|   TestSampleDescription
++---------------------------------------------------------------------*/
+static AP4_SampleDescription*
+TestSampleDescription()
+{
+    return new AP4_SampleDescription(AP4_SampleDescription::TYPE_UNKNOWN,
+                                     AP4_ATOM_TYPE('t','e','s','t'),
+                                     NULL);
+}
+
+/*----------------------------------------------------------------------
+|   TestProcessorInstrumentation
++---------------------------------------------------------------------*/
+class XorTrackHandler : public AP4_Processor::TrackHandler {
+public:
+    AP4_Result ProcessSample(AP4_DataBuffer& data_in, AP4_DataBuffer& data_out) {
+        data_out.SetData(data_in.GetData(), data_in.GetDataSize());
+        for (unsigned int i=0; i<data_out.GetDataSize(); i++) data_out.UseData()[i] ^= 0x5A;
+        return AP4_SUCCESS;
+    }
+};
+
+class XorProcessor : public AP4_Processor {
+public:
+    TrackHandler* CreateTrackHandler(AP4_TrakAtom* /* trak */) { return new XorTrackHandler(); }
+};
+
+class PhaseCounter : public AP4_Processor::Instrumentation {
+public:
+    PhaseCounter() : m_Time(0) {
+        AP4_SetMemory(m_Duration, 0, sizeof(m_Duration));
+        AP4_SetMemory(m_Bytes,    0, sizeof(m_Bytes));
+        AP4_SetMemory(m_Samples,  0, sizeof(m_Samples));
+    }
+    
+    // a fake clock, that ticks each time it is read
+    AP4_UI64 GetTime() { return ++m_Time; }
+    
+    void OnPhase(Phase phase, AP4_UI32 track_id, AP4_UI64 duration, AP4_UI64 bytes, AP4_Cardinal samples) {
+        unsigned int track = track_id ? 1 : 0;
+        m_Duration[phase][track] += duration;
+        m_Bytes[phase][track]    += bytes;
+        m_Samples[phase][track]  += samples;
+    }
+    
+    AP4_UI64 m_Time;
+    AP4_UI64 m_Duration[PHASE_WRITE+1][2];
+    AP4_UI64 m_Bytes[PHASE_WRITE+1][2];
+    AP4_UI64 m_Samples[PHASE_WRITE+1][2];
+};
+
+static int
+TestProcessorInstrumentation()
+{
+    // make up a file with a single track
+    const unsigned int    sample_count = 20;
+    AP4_MemoryByteStream* sample_data  = new AP4_MemoryByteStream();
+    AP4_Array<AP4_Size>   sample_sizes;
+    AP4_UI64              samples_size = 0;
+    for (unsigned int i=0; i<sample_count; i++) {
+        AP4_Size sample_size = 1+(AP4_Size)(rand()%1000);
+        for (unsigned int j=0; j<sample_size; j++) sample_data->WriteUI08((AP4_UI08)rand());
+        sample_sizes.Append(sample_size);
+        samples_size += sample_size;
+    }
+    AP4_MemoryByteStream* input = new AP4_MemoryByteStream();
+    CHECK(WriteTestMovie(AP4_Track::TYPE_VIDEO, TestSampleDescription(), sample_data, sample_sizes, 0, false, *input) == AP4_SUCCESS);
+    sample_data->Release();
+    
+    // process it, with and without instrumentation
+    AP4_MemoryByteStream* output       = new AP4_MemoryByteStream();
+    AP4_MemoryByteStream* plain_output = new AP4_MemoryByteStream();
+    PhaseCounter counter;
+    XorProcessor processor;
+    input->Seek(0);
+    CHECK(processor.Process(*input, *plain_output) == AP4_SUCCESS);
+    processor.SetInstrumentation(&counter);
+    input->Seek(0);
+    CHECK(processor.Process(*input, *output) == AP4_SUCCESS);
+    CHECK(output->GetDataSize() == plain_output->GetDataSize());
+    CHECK(BuffersEqual(output->GetData(), plain_output->GetData(), output->GetDataSize()));
+    
+    // all the work is accounted for
+    CHECK(counter.m_Bytes[PhaseCounter::PHASE_PARSE][0] == input->GetDataSize());
+    CHECK(counter.m_Samples[PhaseCounter::PHASE_SAMPLE_TABLE][1] == sample_count);
+    CHECK(counter.m_Samples[PhaseCounter::PHASE_SAMPLE_TABLE][0] == sample_count);
+    CHECK(counter.m_Bytes[PhaseCounter::PHASE_READ][1] == samples_size);
+    CHECK(counter.m_Samples[PhaseCounter::PHASE_READ][1] == sample_count);
+    CHECK(counter.m_Bytes[PhaseCounter::PHASE_PROCESS][1] == samples_size);
+    CHECK(counter.m_Samples[PhaseCounter::PHASE_PROCESS][1] == sample_count);
+    CHECK(counter.m_Bytes[PhaseCounter::PHASE_WRITE][1] == samples_size);
+    CHECK(counter.m_Bytes[PhaseCounter::PHASE_WRITE][0]+samples_size == output->GetDataSize());
+    for (unsigned int phase=0; phase<=PhaseCounter::PHASE_WRITE; phase++) {
+        CHECK(counter.m_Duration[phase][0]+counter.m_Duration[phase][1] > 0);
+    }
+    
+    input->Release();
+    output->Release();
+    plain_output->Release();
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestSampleDataViews
++---------------------------------------------------------------------*/
+static int
+TestSampleDataViews()
+{
+    AP4_UI08 data[1000];
+    for (unsigned int i=0; i<sizeof(data); i++) data[i] = (AP4_UI08)rand();
+    AP4_MemoryByteStream* stream = new AP4_MemoryByteStream(data, sizeof(data));
+    
+    // direct pointers, within bounds only
+    CHECK(stream->GetDirectPointer(0, sizeof(data)) == stream->GetData());
+    CHECK(stream->GetDirectPointer(sizeof(data), 0) == stream->GetData()+sizeof(data));
+    CHECK(stream->GetDirectPointer(sizeof(data)-1, 2) == NULL);
+    CHECK(stream->GetDirectPointer(0xFFFFFFFF, 2) == NULL);
+    AP4_SubStream* sub_stream = new AP4_SubStream(*stream, 100, 200);
+    CHECK(sub_stream->GetDirectPointer(5, 10) == stream->GetData()+105);
+    CHECK(sub_stream->GetDirectPointer(195, 10) == NULL);
+    sub_stream->Release();
+
+    // sample views refer to the stream data, copies are the same
+    AP4_Sample sample(*stream, 20, 30, 0, 0, 0, 0, true);
+    AP4_DataBuffer view;
+    AP4_DataBuffer copy;
+    CHECK(sample.ReadDataView(view) == AP4_SUCCESS);
+    CHECK(view.GetData() == stream->GetData()+20);
+    CHECK(view.GetDataSize() == 30);
+    CHECK(sample.ReadData(copy) == AP4_SUCCESS);
+    CHECK(copy.GetDataSize() == 30);
+    CHECK(BuffersEqual(copy.GetData(), data+20, 30));
+    AP4_Position position = 0;
+    CHECK(stream->Tell(position) == AP4_SUCCESS);
+    CHECK(position == 50);
+    AP4_Sample outside(*stream, 990, 30, 0, 0, 0, 0, true);
+    CHECK(outside.ReadDataView(view) == AP4_ERROR_NOT_SUPPORTED);
+    
+    // streams that don't hold the data in memory
+    stream->Seek(0);
+    AP4_BufferedInputStream* buffered = new AP4_BufferedInputStream(*stream);
+    AP4_Sample buffered_sample(*buffered, 20, 30, 0, 0, 0, 0, true);
+    CHECK(buffered_sample.ReadDataView(view) == AP4_ERROR_NOT_SUPPORTED);
+    CHECK(buffered_sample.ReadData(copy) == AP4_SUCCESS);
+    CHECK(BuffersEqual(copy.GetData(), data+20, 30));
+    buffered->Release();
+    stream->Release();
+
+    // processing samples from views leaves the input untouched
+    AP4_MemoryByteStream* sample_data = new AP4_MemoryByteStream(data, sizeof(data));
+    AP4_Array<AP4_Size>   sample_sizes;
+    for (unsigned int i=0; i<10; i++) sample_sizes.Append(100);
+    AP4_MemoryByteStream* input = new AP4_MemoryByteStream();
+    CHECK(WriteTestMovie(AP4_Track::TYPE_VIDEO, TestSampleDescription(), sample_data, sample_sizes, 0, false, *input) == AP4_SUCCESS);
+    sample_data->Release();
+    AP4_DataBuffer input_data(input->GetData(), input->GetDataSize());
+    AP4_MemoryByteStream* output          = new AP4_MemoryByteStream();
+    AP4_MemoryByteStream* buffered_output = new AP4_MemoryByteStream();
+    XorProcessor processor;
+    input->Seek(0);
+    CHECK(processor.Process(*input, *output) == AP4_SUCCESS);
+    CHECK(output->GetDataSize() == input_data.GetDataSize());
+    CHECK(BuffersEqual(input->GetData(), input_data.GetData(), input_data.GetDataSize()));
+    input->Seek(0);
+    buffered = new AP4_BufferedInputStream(*input);
+    CHECK(processor.Process(*buffered, *buffered_output) == AP4_SUCCESS);
+    CHECK(output->GetDataSize() == buffered_output->GetDataSize());
+    CHECK(BuffersEqual(output->GetData(), buffered_output->GetData(), output->GetDataSize()));
+    buffered->Release();
+    input->Release();
+    output->Release();
+    buffered_output->Release();
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   AppendOnlyStream
++---------------------------------------------------------------------*/
+class AppendOnlyStream : public AP4_MemoryByteStream {
+public:
+    AppendOnlyStream() : m_WriteBuffersCount(0) {}
+    
+    // like a pipe, only the current position can be sought
+    AP4_Result Seek(AP4_Position position) {
+        AP4_Position current = 0;
+        Tell(current);
+        return position == current ? AP4_SUCCESS : AP4_ERROR_NOT_SUPPORTED;
+    }
+    AP4_Result WriteBuffers(const Buffer* buffers, unsigned int buffer_count) {
+        ++m_WriteBuffersCount;
+        return AP4_MemoryByteStream::WriteBuffers(buffers, buffer_count);
+    }
+    
+    unsigned int m_WriteBuffersCount;
+};
+
+/*----------------------------------------------------------------------
+|   CompareXorFragments
++---------------------------------------------------------------------*/
+static int
+CompareXorFragments(AP4_MemoryByteStream& input, AP4_MemoryByteStream& output)
+{
+    // the atoms are the same, except for the moov and the processed samples
+    const AP4_UI08* in_data   = input.GetData();
+    const AP4_UI08* out_data  = output.GetData();
+    AP4_Size        in_size   = input.GetDataSize();
+    AP4_Size        out_size  = output.GetDataSize();
+    AP4_Size        in_offset = 0;
+    AP4_Size        offset    = 0;
+    int             fragments = 0;
+    while (in_offset+AP4_ATOM_HEADER_SIZE <= in_size) {
+        CHECK(offset+AP4_ATOM_HEADER_SIZE <= out_size);
+        AP4_UI32 in_atom_size = AP4_BytesToUInt32BE(in_data+in_offset);
+        AP4_UI32 atom_size    = AP4_BytesToUInt32BE(out_data+offset);
+        AP4_UI32 atom_type    = AP4_BytesToUInt32BE(out_data+offset+4);
+        CHECK(atom_type == AP4_BytesToUInt32BE(in_data+in_offset+4));
+        CHECK(atom_size >= AP4_ATOM_HEADER_SIZE && offset+atom_size <= out_size);
+        if (atom_type == AP4_ATOM_TYPE_MDAT) {
+            CHECK(atom_size == in_atom_size);
+            for (unsigned int i=AP4_ATOM_HEADER_SIZE; i<atom_size; i++) {
+                CHECK(out_data[offset+i] == (in_data[in_offset+i] ^ 0x5A));
+            }
+            ++fragments;
+        } else if (atom_type != AP4_ATOM_TYPE_MOOV) {
+            CHECK(atom_size == in_atom_size);
+            CHECK(BuffersEqual(out_data+offset, in_data+in_offset, atom_size));
+        }
+        in_offset += in_atom_size;
+        offset    += atom_size;
+    }
+    CHECK(in_offset == in_size);
+    CHECK(offset == out_size);
+    
+    return fragments;
+}
+
+/*----------------------------------------------------------------------
+|   MakeFragments
++---------------------------------------------------------------------*/
+static AP4_MemoryByteStream*
+MakeFragments(AP4_Track::Type        track_type,
+              AP4_SampleDescription* sample_description,
+              unsigned int           sample_count,
+              unsigned int           samples_per_fragment,
+              bool                   with_sidx)
+{
+    AP4_MemoryByteStream* sample_data = new AP4_MemoryByteStream();
+    AP4_Array<AP4_Size>   sample_sizes;
+    for (unsigned int i=0; i<sample_count; i++) {
+        AP4_Size sample_size = 1+(AP4_Size)(rand()%500);
+        for (unsigned int j=0; j<sample_size; j++) sample_data->WriteUI08((AP4_UI08)rand());
+        sample_sizes.Append(sample_size);
+    }
+    AP4_MemoryByteStream* input = new AP4_MemoryByteStream();
+    AP4_Result result = WriteTestMovie(track_type, sample_description,
+                                       sample_data, sample_sizes, samples_per_fragment,
+                                       with_sidx, *input);
+    sample_data->Release();
+    if (AP4_FAILED(result)) {
+        input->Release();
+        return NULL;
+    }
+    
+    return input;
+}
+
+/*----------------------------------------------------------------------
+|   TestFragmentWrites
++---------------------------------------------------------------------*/
+static int
+TestFragmentWrites()
+{
+    // make up a fragmented file, with a few fragments
+    const unsigned int fragment_count = 3;
+    AP4_MemoryByteStream* input = MakeFragments(AP4_Track::TYPE_VIDEO, TestSampleDescription(), fragment_count*8, 8, false);
+    CHECK(input != NULL);
+    
+    // process it into a stream that can't seek back
+    AppendOnlyStream* output = new AppendOnlyStream();
+    XorProcessor processor;
+    input->Seek(0);
+    CHECK(processor.Process(*input, *output) == AP4_SUCCESS);
+    CHECK(output->m_WriteBuffersCount == fragment_count);
+    
+    // the fragments are unchanged, except for the processed samples
+    CHECK(CompareXorFragments(*input, *output) == (int)fragment_count);
+    
+    input->Release();
+    output->Release();
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestFragmentIndexWrites
++---------------------------------------------------------------------*/
+static int
+TestFragmentIndexWrites()
+{
+    // make up a fragmented file, indexed by a sidx
+    const unsigned int fragment_count = 4;
+    AP4_MemoryByteStream* input = MakeFragments(AP4_Track::TYPE_VIDEO, TestSampleDescription(), fragment_count*5, 5, true);
+    CHECK(input != NULL);
+    
+    // the sidx is rewritten at the end, which a stream that can't seek
+    // back can't do
+    AppendOnlyStream* append_only = new AppendOnlyStream();
+    XorProcessor processor;
+    input->Seek(0);
+    CHECK(processor.Process(*input, *append_only) == AP4_ERROR_NOT_SUPPORTED);
+    append_only->Release();
+    
+    // any other stream gets the whole file, with the sidx in place
+    AP4_MemoryByteStream* output = new AP4_MemoryByteStream();
+    input->Seek(0);
+    CHECK(processor.Process(*input, *output) == AP4_SUCCESS);
+    CHECK(CompareXorFragments(*input, *output) == (int)fragment_count);
+    
+    input->Release();
+    output->Release();
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   AudioSampleDescription
++---------------------------------------------------------------------*/
+static AP4_SampleDescription*
+AudioSampleDescription()
+{
+    return new AP4_MpegAudioSampleDescription(AP4_OTI_MPEG4_AUDIO, 44100, 16, 2, NULL, 0, 0, 0);
+}
+
+/*----------------------------------------------------------------------
+|   MakeCencFragments
++---------------------------------------------------------------------*/
+static AP4_MemoryByteStream*
+MakeCencFragments(const AP4_UI08* key, unsigned int sample_count, unsigned int samples_per_fragment)
+{
+    AP4_MemoryByteStream* clear = MakeFragments(AP4_Track::TYPE_AUDIO, AudioSampleDescription(),
+                                                sample_count, samples_per_fragment, false);
+    if (clear == NULL) return NULL;
+    AP4_MemoryByteStream* encrypted = EncryptTestMovie(*clear, key, "00112233445566778899aabbccddeeff");
+    clear->Release();
+    
+    return encrypted;
+}
+
+/*----------------------------------------------------------------------
+|   TestCencParallelFragments
++---------------------------------------------------------------------*/
+class ReverseRunner : public AP4_Processor::ParallelRunner {
+public:
+    ReverseRunner() : m_RangeCount(0) {}
+
+    // run ranges of up to 3 items, the last range first
+    AP4_Result Run(Job& job, AP4_Cardinal item_count) {
+        for (AP4_Cardinal end=item_count; end;) {
+            AP4_Cardinal count = end < 3 ? end : 3;
+            end -= count;
+            ++m_RangeCount;
+            AP4_Result result = job.Run(end, count);
+            if (AP4_FAILED(result)) return result;
+        }
+        return AP4_SUCCESS;
+    }
+
+    unsigned int m_RangeCount;
+};
+
+static int
+TestCencParallelFragments()
+{
+    AP4_UI08 key[16];
+    for (unsigned int i=0; i<sizeof(key); i++) key[i] = (AP4_UI08)rand();
+    AP4_MemoryByteStream* encrypted = MakeCencFragments(key, 100, 30);
+    CHECK(encrypted != NULL);
+    AP4_ProtectionKeyMap key_map;
+    key_map.SetKey(1, key, 16);
+    
+    // decrypt the samples one by one
+    AP4_MemoryByteStream* expected = new AP4_MemoryByteStream();
+    AP4_CencDecryptingProcessor serial(&key_map);
+    encrypted->Seek(0);
+    CHECK(serial.Process(*encrypted, *expected) == AP4_SUCCESS);
+    
+    // decrypt them in ranges, from the input where it is, and from
+    // copies decrypted in place
+    for (unsigned int buffered=0; buffered<2; buffered++) {
+        ReverseRunner runner;
+        AP4_CencDecryptingProcessor parallel(&key_map);
+        parallel.SetParallelRunner(&runner);
+        AP4_MemoryByteStream* output = new AP4_MemoryByteStream();
+        encrypted->Seek(0);
+        AP4_BufferedInputStream* buffered_input = new AP4_BufferedInputStream(*encrypted);
+        CHECK(parallel.Process(buffered ? (AP4_ByteStream&)*buffered_input : *encrypted, *output) == AP4_SUCCESS);
+        buffered_input->Release();
+        CHECK(runner.m_RangeCount >= 100/3);
+        CHECK(output->GetDataSize() == expected->GetDataSize());
+        CHECK(BuffersEqual(output->GetData(), expected->GetData(), expected->GetDataSize()));
+        output->Release();
+    }
+    expected->Release();
+    encrypted->Release();
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestCencInPlaceNonFragmented
++---------------------------------------------------------------------*/
+static int
+TestCencInPlaceNonFragmented()
+{
+    // make up a non-fragmented audio track, and encrypt it
+    AP4_UI08 data[1000];
+    for (unsigned int i=0; i<sizeof(data); i++) data[i] = (AP4_UI08)rand();
+    AP4_MemoryByteStream* sample_data = new AP4_MemoryByteStream(data, sizeof(data));
+    AP4_Array<AP4_Size>   sample_sizes;
+    for (unsigned int i=0; i<10; i++) sample_sizes.Append(100);
+    AP4_MemoryByteStream* clear = new AP4_MemoryByteStream();
+    CHECK(WriteTestMovie(AP4_Track::TYPE_AUDIO, AudioSampleDescription(), sample_data, sample_sizes, 0, false, *clear) == AP4_SUCCESS);
+    sample_data->Release();
+    AP4_UI08 key[16];
+    for (unsigned int i=0; i<sizeof(key); i++) key[i] = (AP4_UI08)rand();
+    AP4_MemoryByteStream* encrypted = EncryptTestMovie(*clear, key, "00112233445566778899aabbccddeeff");
+    clear->Release();
+    CHECK(encrypted != NULL);
+    
+    // it can't be decrypted in place, and is left as it was
+    AP4_DataBuffer expected(encrypted->GetData(), encrypted->GetDataSize());
+    AP4_ProtectionKeyMap key_map;
+    key_map.SetKey(1, key, 16);
+    AP4_CencDecryptingProcessor decrypter(&key_map);
+    CHECK(decrypter.ProcessInPlace(encrypted->UseData(), encrypted->GetDataSize()) == AP4_ERROR_NOT_SUPPORTED);
+    CHECK(BuffersEqual(encrypted->GetData(), expected.GetData(), expected.GetDataSize()));
+    encrypted->Release();
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestCencInPlaceFailures
++---------------------------------------------------------------------*/
+static int
+TestCencInPlaceFailures()
+{
+    AP4_UI08 key[16];
+    for (unsigned int i=0; i<sizeof(key); i++) key[i] = (AP4_UI08)rand();
+    AP4_MemoryByteStream* encrypted = MakeCencFragments(key, 40, 10);
+    CHECK(encrypted != NULL);
+    AP4_UI08*      data      = encrypted->UseData();
+    AP4_Size       data_size = encrypted->GetDataSize();
+    AP4_DataBuffer expected(data, data_size);
+    AP4_ProtectionKeyMap key_map;
+    key_map.SetKey(1, key, 16);
+    AP4_CencDecryptingProcessor decrypter(&key_map);
+    
+    // the last fragment is cut short: nothing is decrypted
+    CHECK(decrypter.ProcessInPlace(data, data_size-10) == AP4_ERROR_INVALID_FORMAT);
+    CHECK(BuffersEqual(data, expected.GetData(), data_size));
+    
+    // the last fragment is for an unknown track: nothing is decrypted
+    AP4_Size tfhd_offset = 0;
+    for (AP4_Size i=0; i+12 <= data_size; i++) {
+        if (AP4_BytesToUInt32BE(data+i) == AP4_ATOM_TYPE_TFHD) tfhd_offset = i-4;
+    }
+    CHECK(tfhd_offset != 0);
+    AP4_BytesFromUInt32BE(data+tfhd_offset+12, 99);
+    expected.SetData(data, data_size);
+    CHECK(decrypter.ProcessInPlace(data, data_size) == AP4_ERROR_INVALID_FORMAT);
+    CHECK(BuffersEqual(data, expected.GetData(), data_size));
+    
+    // once it is fixed, all of it is decrypted
+    AP4_BytesFromUInt32BE(data+tfhd_offset+12, 1);
+    CHECK(decrypter.ProcessInPlace(data, data_size) == AP4_SUCCESS);
+    for (AP4_Size i=0; i+4 <= data_size; i++) {
+        CHECK(AP4_BytesToUInt32BE(data+i) != AP4_ATOM_TYPE_ENCA);
+        CHECK(AP4_BytesToUInt32BE(data+i) != AP4_ATOM_TYPE_SENC);
+    }
+    encrypted->Release();
+    
+    return 0;
+}
+
+int
+main(int /*argc*/, char** /*argv*/)
+{
+    int result;
+    
+    result = TestProcessorInstrumentation();
+    if (result) return result;
+    
+    result = TestSampleDataViews();
+    if (result) return result;
+    
+    result = TestFragmentWrites();
+    if (result) return result;
+    
+    result = TestFragmentIndexWrites();
+    if (result) return result;
+    
+    result = TestCencParallelFragments();
+    if (result) return result;
+    
+    result = TestCencInPlaceNonFragmented();
+    if (result) return result;
+    
+    result = TestCencInPlaceFailures();
+    if (result) return result;
+    
+    return 0;
+}
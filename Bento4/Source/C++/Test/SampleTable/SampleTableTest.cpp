@@ -0,0 +1,245 @@
+/*****************************************************************
+|
+|    AP4 - Sample Table Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Ap4.h"
+
+/*----------------------------------------------------------------------
+|   CHECK
++---------------------------------------------------------------------*/
+#define CHECK(x) if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); DebugHook(); return -1; }
+
+/*----------------------------------------------------------------------
+|   DebugHook
++---------------------------------------------------------------------*/
+static void
+DebugHook()
+{
+    // put a breakpoint here
+    fprintf(stderr, "Debug Hook\n");
+}
+
+/*----------------------------------------------------------------------
+|   TestAtomSampleTable
++---------------------------------------------------------------------*/
+static int
+TestAtomSampleTable()
+{
+    // two small chunks, one large chunk, then three single-sample chunks
+    const unsigned int sample_count = 2*3+100+3*1;
+    AP4_UI32 chunk_offsets[6] = { 1000, 5000, 9000, 20000, 30000, 40000 };
+    AP4_ContainerAtom stbl(AP4_ATOM_TYPE_STBL);
+    AP4_StscAtom* stsc = new AP4_StscAtom();
+    stsc->AddEntry(2, 3,   1);
+    stsc->AddEntry(1, 100, 2);
+    stsc->AddEntry(3, 1,   1);
+    stbl.AddChild(stsc);
+    stbl.AddChild(new AP4_StcoAtom(chunk_offsets, 6));
+    AP4_StszAtom* stsz = new AP4_StszAtom();
+    for (unsigned int i=0; i<sample_count; i++) stsz->AddEntry(i+1);
+    stbl.AddChild(stsz);
+    
+    // where each sample should be
+    AP4_UI64    offsets[sample_count];
+    AP4_Ordinal descriptions[sample_count];
+    for (unsigned int i=0, chunk=0; i<sample_count; chunk++) {
+        unsigned int samples_in_chunk = chunk < 2 ? 3 : chunk == 2 ? 100 : 1;
+        AP4_UI64 offset = chunk_offsets[chunk];
+        for (unsigned int j=0; j<samples_in_chunk; j++, i++) {
+            offsets[i]      = offset;
+            descriptions[i] = chunk == 2 ? 1 : 0;
+            offset += i+1;
+        }
+    }
+    
+    // look the samples up backwards, then forwards
+    AP4_MemoryByteStream* sample_stream = new AP4_MemoryByteStream();
+    AP4_AtomSampleTable* sample_table = new AP4_AtomSampleTable(&stbl, *sample_stream);
+    sample_stream->Release();
+    CHECK(sample_table->GetSampleCount() == sample_count);
+    AP4_Sample sample;
+    for (unsigned int i=sample_count; i--; ) {
+        CHECK(sample_table->GetSample(i, sample) == AP4_SUCCESS);
+        CHECK(sample.GetOffset() == offsets[i]);
+        CHECK(sample.GetSize() == i+1);
+        CHECK(sample.GetDescriptionIndex() == descriptions[i]);
+    }
+    for (unsigned int i=0; i<sample_count; i++) {
+        CHECK(sample_table->GetSample(i, sample) == AP4_SUCCESS);
+        CHECK(sample.GetOffset() == offsets[i]);
+    }
+    CHECK(AP4_FAILED(sample_table->GetSample(sample_count, sample)));
+    
+    // changes to the tables are picked up
+    CHECK(sample_table->SetChunkOffset(2, 7000) == AP4_SUCCESS);
+    CHECK(sample_table->GetSample(50, sample) == AP4_SUCCESS);
+    CHECK(sample.GetOffset() == offsets[50]-9000+7000);
+    CHECK(sample_table->SetSampleSize(49, 50+4) == AP4_SUCCESS);
+    CHECK(sample_table->GetSample(50, sample) == AP4_SUCCESS);
+    CHECK(sample.GetOffset() == offsets[50]-9000+7000+4);
+    CHECK(sample_table->GetSample(49, sample) == AP4_SUCCESS);
+    CHECK(sample.GetOffset() == offsets[49]-9000+7000);
+    CHECK(sample.GetSize() == 50+4);
+    
+    delete sample_table;
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   NearestSyncSample
++---------------------------------------------------------------------*/
+static AP4_Ordinal
+NearestSyncSample(const AP4_Array<AP4_UI32>& entries, 
+                  AP4_Ordinal                sample_index, 
+                  bool                       before,
+                  AP4_Cardinal               sample_count)
+{
+    // straight scan of the table, as a reference
+    sample_index += 1;
+    AP4_Ordinal cursor = 0;
+    for (unsigned int i=0; i<entries.ItemCount(); i++) {
+        if (entries[i] >= sample_index) {
+            if (before) return cursor;
+            return entries[i]?entries[i]-1:sample_index-1;
+        }
+        if (entries[i]) cursor = entries[i]-1;
+    }
+    return before ? cursor : sample_count;
+}
+
+/*----------------------------------------------------------------------
+|   TestTimeIndex
++---------------------------------------------------------------------*/
+static int
+TestTimeIndex()
+{
+    // a variable frame rate track, with a few empty entries
+    const unsigned int entry_count = 1000;
+    AP4_UI32 counts[entry_count];
+    AP4_UI32 durations[entry_count];
+    AP4_ContainerAtom stbl(AP4_ATOM_TYPE_STBL);
+    AP4_SttsAtom* stts = new AP4_SttsAtom();
+    AP4_Cardinal sample_count   = 0;
+    AP4_UI64     total_duration = 0;
+    for (unsigned int i=0; i<entry_count; i++) {
+        counts[i]    = (i%97 == 0) ? 0 : 1+rand()%5;
+        durations[i] = (i%89 == 0) ? 0 : 1+rand()%3000;
+        stts->AddEntry(counts[i], durations[i]);
+        sample_count   += counts[i];
+        total_duration += (AP4_UI64)counts[i]*durations[i];
+    }
+    stbl.AddChild(stts);
+    AP4_StszAtom* stsz = new AP4_StszAtom();
+    for (unsigned int i=0; i<sample_count; i++) stsz->AddEntry(1);
+    stbl.AddChild(stsz);
+    AP4_StssAtom* stss = new AP4_StssAtom();
+    for (unsigned int i=1; i<=sample_count; i += 1+rand()%60) stss->AddEntry(i);
+    stbl.AddChild(stss);
+    AP4_MemoryByteStream* sample_stream = new AP4_MemoryByteStream();
+    AP4_AtomSampleTable sample_table(&stbl, *sample_stream);
+    sample_stream->Release();
+
+    // dts and durations of all the samples
+    AP4_UI64* dts                 = new AP4_UI64[sample_count];
+    AP4_UI32* durations_by_sample = new AP4_UI32[sample_count];
+    for (unsigned int i=0, sample=0, t=0; i<entry_count; i++) {
+        for (unsigned int j=0; j<counts[i]; j++, sample++) {
+            dts[sample] = t;
+            durations_by_sample[sample] = durations[i];
+            t += durations[i];
+        }
+    }
+
+    // dts lookups, in order and at random
+    for (unsigned int i=0; i<2*sample_count; i++) {
+        AP4_Ordinal sample = i < sample_count ? i : (AP4_Ordinal)(rand()%sample_count);
+        AP4_UI64 sample_dts = 0;
+        AP4_UI32 sample_duration = 0;
+        CHECK(stts->GetDts(sample+1, sample_dts, &sample_duration) == AP4_SUCCESS);
+        CHECK(sample_dts == dts[sample]);
+        CHECK(sample_duration == durations_by_sample[sample]);
+    }
+    AP4_UI64 sample_dts;
+    CHECK(stts->GetDts(0, sample_dts) == AP4_ERROR_OUT_OF_RANGE);
+    CHECK(stts->GetDts(sample_count+1, sample_dts) == AP4_ERROR_OUT_OF_RANGE);
+
+    // time stamp lookups
+    for (unsigned int i=0; i<sample_count; i++) {
+        AP4_Ordinal sample = (AP4_Ordinal)(rand()%sample_count);
+        if (durations_by_sample[sample] == 0) continue;
+        AP4_UI64 ts = dts[sample]+rand()%durations_by_sample[sample];
+        AP4_Ordinal index = 0;
+        CHECK(sample_table.GetSampleIndexForTimeStamp(ts, index) == AP4_SUCCESS);
+        CHECK(index == sample);
+    }
+    AP4_Ordinal index;
+    CHECK(sample_table.GetSampleIndexForTimeStamp(total_duration, index) == AP4_FAILURE);
+
+    // entries added later are picked up
+    stts->AddEntry(10, 1);
+    CHECK(sample_table.GetSampleIndexForTimeStamp(total_duration+5, index) == AP4_SUCCESS);
+    CHECK(index == sample_count+5);
+    CHECK(stts->GetDts(sample_count+10, sample_dts) == AP4_SUCCESS);
+    CHECK(sample_dts == total_duration+9);
+
+    // nearest sync samples, with the entries in order and then not
+    for (unsigned int pass=0; pass<2; pass++) {
+        for (unsigned int i=0; i<=sample_count; i++) {
+            for (unsigned int before=0; before<2; before++) {
+                CHECK(sample_table.GetNearestSyncSampleIndex(i, before != 0) == 
+                      NearestSyncSample(stss->GetEntries(), i, before != 0, sample_count));
+            }
+        }
+        stss->AddEntry(sample_count/2);
+    }
+
+    delete[] dts;
+    delete[] durations_by_sample;
+    
+    return 0;
+}
+
+int
+main(int /*argc*/, char** /*argv*/)
+{
+    int result;
+    
+    result = TestAtomSampleTable();
+    if (result) return result;
+    
+    result = TestTimeIndex();
+    if (result) return result;
+    
+    return 0;
+}
@@ -0,0 +1,269 @@
+// @ts-check
+
+const fs = require('fs')
+const path = require('path')
+const crypto = require('crypto')
+const { execFileSync } = require('child_process')
+
+const ROOT = path.join(__dirname, '..')
+const FIXTURES_DIR = path.join(__dirname, 'fixtures')
+const BUILD_DIR = path.join(__dirname, 'build')
+
+const KID = '0123456789abcdef0123456789abcdef'
+const KEY = 'fedcba9876543210fedcba9876543210'
+
+/**
+ * Benchmark fixture
+ * @typedef {Object} Fixture
+ * @property {string} name
+ * @property {string} file
+ * @property {Record<string, string>} keys
+ */
+
+/**
+ * Encrypted fixtures, with their approximate sizes
+ */
+const FIXTURES = [
+  { kind: 'audio', size: 2 * 1024 },
+  { kind: 'audio', size: 64 * 1024 },
+  { kind: 'audio', size: 1024 * 1024 },
+  { kind: 'video', size: 128 * 1024 },
+  { kind: 'video', size: 5 * 1024 * 1024 },
+  { kind: 'video', size: 50 * 1024 * 1024 }
+]
+
+const SCHEMES = [
+  { name: 'cenc', method: 'MPEG-CENC' },
+  { name: 'cbcs', method: 'MPEG-CBCS' }
+]
+
+/**
+ * Returns the encrypted fixtures, generating the missing ones
+ * @returns {Fixture[]}
+ */
+function getFixtures () {
+  fs.mkdirSync(FIXTURES_DIR, { recursive: true })
+
+  const fixtures = []
+  for (const scheme of SCHEMES) {
+    for (const { kind, size } of FIXTURES) {
+      const name = `${kind}-${scheme.name}-${formatSize(size)}`
+      const file = path.join(FIXTURES_DIR, name + '.mp4')
+
+      if (!fs.existsSync(file)) {
+        const clear = path.join(FIXTURES_DIR, `${kind}-${formatSize(size)}.clear.mp4`)
+        if (!fs.existsSync(clear)) {
+          fs.writeFileSync(clear, kind === 'audio' ? makeAudio(size) : makeVideo(size))
+        }
+        encrypt(scheme.method, clear, file)
+      }
+
+      fixtures.push({ name, file, keys: { [KID]: KEY } })
+    }
+  }
+
+  return fixtures
+}
+
+/**
+ * Encrypts a file with mp4encrypt, built from the bundled Bento4 sources
+ * unless the MP4ENCRYPT environment variable points to one
+ * @param {string} method
+ * @param {string} input
+ * @param {string} output
+ */
+function encrypt (method, input, output) {
+  execFileSync(findMp4encrypt(), [
+    '--method', method,
+    '--key', `1:${KEY}:random`,
+    '--property', `1:KID:${KID}`,
+    input,
+    output
+  ])
+}
+
+/**
+ * @returns {string}
+ */
+function findMp4encrypt () {
+  if (process.env.MP4ENCRYPT) return process.env.MP4ENCRYPT
+
+  const candidates = [
+    path.join(BUILD_DIR, 'mp4encrypt'),
+    path.join(BUILD_DIR, 'mp4encrypt.exe'),
+    path.join(BUILD_DIR, 'Release', 'mp4encrypt.exe')
+  ]
+  let found = candidates.find(candidate => fs.existsSync(candidate))
+  if (found) return found
+
+  console.error('Building mp4encrypt...')
+  execFileSync('cmake', ['-S', path.join(ROOT, 'Bento4'), '-B', BUILD_DIR, '-DCMAKE_BUILD_TYPE=Release'], { stdio: 'ignore' })
+  execFileSync('cmake', ['--build', BUILD_DIR, '--target', 'mp4encrypt', '--config', 'Release'], { stdio: 'ignore' })
+  found = candidates.find(candidate => fs.existsSync(candidate))
+  if (!found) throw new Error('Failed to build mp4encrypt')
+
+  return found
+}
+
+/**
+ * Makes a fragmented video file by repeating the fragment of the test file
+ * @param {number} size
+ * @returns {Buffer}
+ */
+function makeVideo (size) {
+  const src = fs.readFileSync(path.join(ROOT, 'test', 'media', 'test1src.mp4'))
+  const boxes = readBoxes(src)
+  const header = boxes.filter(b => b.type === 'ftyp' || b.type === 'moov').map(b => b.data)
+  const moof = boxes.find(b => b.type === 'moof')
+  const mdat = boxes.find(b => b.type === 'mdat')
+  if (!moof || !mdat) throw new Error('The test file is not fragmented')
+
+  const parts = header
+  let total = parts.reduce((sum, part) => sum + part.length, 0)
+  for (let sequence = 1; total < size; sequence++) {
+    const fragment = Buffer.from(moof.data)
+    // the mfhd box comes first in the moof box
+    fragment.writeUInt32BE(sequence, 8 + 12)
+    parts.push(fragment, mdat.data)
+    total += fragment.length + mdat.data.length
+  }
+
+  return Buffer.concat(parts)
+}
+
+/**
+ * Makes a fragmented AAC file, with random data as samples
+ * @param {number} size
+ * @returns {Buffer}
+ */
+function makeAudio (size) {
+  const sampleSize = 371 // 128 kbit/s
+  const samplesPerFragment = 86 // 2 seconds
+
+  const parts = [
+    box('ftyp', Buffer.from('iso6'), uint32(0), Buffer.from('iso6mp41')),
+    audioMoov()
+  ]
+  let total = parts[0].length + parts[1].length
+  for (let sequence = 1; total < size; sequence++) {
+    const sampleCount = Math.min(samplesPerFragment, Math.ceil((size - total) / sampleSize))
+    const sizes = new Array(sampleCount).fill(sampleSize)
+    const baseTime = (sequence - 1) * samplesPerFragment * 1024
+    const fragment = audioFragment(sequence, baseTime, sizes)
+    parts.push(fragment)
+    total += fragment.length
+  }
+
+  return Buffer.concat(parts)
+}
+
+function audioMoov () {
+  const matrix = Buffer.concat([0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000].map(uint32))
+
+  const esds = fullBox('esds', 0, 0, Buffer.from([
+    0x03, 25, 0x00, 0x01, 0x00, // ES_Descriptor
+    0x04, 17, 0x40, 0x15, 0x00, 0x00, 0x00, // DecoderConfigDescriptor
+    0x00, 0x01, 0xf4, 0x00, 0x00, 0x01, 0xf4, 0x00,
+    0x05, 2, 0x12, 0x10, // AAC LC, 44.1 kHz, stereo
+    0x06, 1, 0x02 // SLConfigDescriptor
+  ]))
+  const mp4a = box('mp4a',
+    Buffer.alloc(6), uint16(1), Buffer.alloc(8),
+    uint16(2), uint16(16), Buffer.alloc(4), uint32(44100 << 16 >>> 0),
+    esds)
+
+  const stbl = box('stbl',
+    fullBox('stsd', 0, 0, uint32(1), mp4a),
+    fullBox('stts', 0, 0, uint32(0)),
+    fullBox('stsc', 0, 0, uint32(0)),
+    fullBox('stsz', 0, 0, uint32(0), uint32(0)),
+    fullBox('stco', 0, 0, uint32(0)))
+
+  return box('moov',
+    fullBox('mvhd', 0, 0, uint32(0), uint32(0), uint32(1000), uint32(0),
+      uint32(0x00010000), uint16(0x0100), Buffer.alloc(10), matrix, Buffer.alloc(24), uint32(2)),
+    box('trak',
+      fullBox('tkhd', 0, 3, uint32(0), uint32(0), uint32(1), uint32(0), uint32(0),
+        Buffer.alloc(8), uint16(0), uint16(0), uint16(0x0100), uint16(0), matrix, uint32(0), uint32(0)),
+      box('mdia',
+        fullBox('mdhd', 0, 0, uint32(0), uint32(0), uint32(44100), uint32(0), uint16(0x55c4), uint16(0)),
+        fullBox('hdlr', 0, 0, uint32(0), Buffer.from('soun'), Buffer.alloc(12), Buffer.from('SoundHandler\0')),
+        box('minf',
+          fullBox('smhd', 0, 0, uint16(0), uint16(0)),
+          box('dinf', fullBox('dref', 0, 0, uint32(1), fullBox('url ', 0, 1))),
+          stbl))),
+    box('mvex', fullBox('trex', 0, 0, uint32(1), uint32(1), uint32(1024), uint32(0), uint32(0))))
+}
+
+/**
+ * @param {number} sequence
+ * @param {number} baseTime
+ * @param {number[]} sizes
+ * @returns {Buffer}
+ */
+function audioFragment (sequence, baseTime, sizes) {
+  const moof = (dataOffset) => box('moof',
+    fullBox('mfhd', 0, 0, uint32(sequence)),
+    box('traf',
+      fullBox('tfhd', 0, 0x020000, uint32(1)),
+      fullBox('tfdt', 1, 0, uint32(Math.floor(baseTime / 0x100000000)), uint32(baseTime >>> 0)),
+      fullBox('trun', 0, 0x000201, uint32(sizes.length), uint32(dataOffset), ...sizes.map(uint32))))
+
+  const moofSize = moof(0).length
+  const data = crypto.randomBytes(sizes.reduce((sum, size) => sum + size, 0))
+
+  return Buffer.concat([moof(moofSize + 8), box('mdat', data)])
+}
+
+/**
+ * @param {string} type
+ * @param {...Buffer} payloads
+ * @returns {Buffer}
+ */
+function box (type, ...payloads) {
+  const payload = Buffer.concat(payloads)
+  return Buffer.concat([uint32(8 + payload.length), Buffer.from(type, 'latin1'), payload])
+}
+
+/**
+ * @param {string} type
+ * @param {number} version
+ * @param {number} flags
+ * @param {...Buffer} payloads
+ * @returns {Buffer}
+ */
+function fullBox (type, version, flags, ...payloads) {
+  return box(type, uint32((version << 24 | flags) >>> 0), ...payloads)
+}
+
+function uint16 (value) {
+  const buffer = Buffer.alloc(2)
+  buffer.writeUInt16BE(value)
+  return buffer
+}
+
+function uint32 (value) {
+  const buffer = Buffer.alloc(4)
+  buffer.writeUInt32BE(value)
+  return buffer
+}
+
+/**
+ * @param {Buffer} file
+ * @returns {{ type: string, data: Buffer }[]}
+ */
+function readBoxes (file) {
+  const boxes = []
+  for (let offset = 0; offset < file.length;) {
+    const size = file.readUInt32BE(offset)
+    boxes.push({ type: file.toString('latin1', offset + 4, offset + 8), data: file.subarray(offset, offset + size) })
+    offset += size
+  }
+  return boxes
+}
+
+function formatSize (size) {
+  return size >= 1024 * 1024 ? `${size / (1024 * 1024)}MB` : `${size / 1024}KB`
+}
+
+module.exports = { getFixtures }
@@ -0,0 +1,158 @@
+// @ts-check
+
+const fs = require('fs')
+const os = require('os')
+const { execFileSync } = require('child_process')
+const mp4decrypt = require('..')
+const { getFixtures } = require('./fixtures')
+
+/**
+ * Number of decryptions in flight at the same time
+ */
+const CONCURRENCY_LEVELS = [...new Set([1, 4, os.cpus().length])].sort((a, b) => a - b)
+
+/**
+ * Each measurement runs at least this many decryptions, for at least
+ * this long, but stops after MAX_RUNS decryptions
+ */
+const MIN_RUNS = 20
+const MIN_TIME_MS = 2000
+const MAX_RUNS = 5000
+
+/**
+ * Result of a single measurement
+ * @typedef {Object} Result
+ * @property {string} fixture
+ * @property {number} size input size, in bytes
+ * @property {number} concurrency
+ * @property {number} runs
+ * @property {number} mbPerSecond input MB decrypted per second
+ * @property {number} p50Ms
+ * @property {number} p99Ms
+ * @property {number} maxRssMb
+ */
+
+main().catch(err => {
+  console.error(err)
+  process.exit(1)
+})
+
+async function main () {
+  const options = parseArgs(process.argv.slice(2))
+
+  /** @type {Result[]} */
+  const results = []
+  for (const fixture of getFixtures()) {
+    if (options.filter && !fixture.name.includes(options.filter)) continue
+
+    const buffer = fs.readFileSync(fixture.file)
+    // warm up, and make sure the fixture decrypts
+    await mp4decrypt.decrypt(buffer, fixture.keys)
+
+    for (const concurrency of CONCURRENCY_LEVELS) {
+      const result = await measure(fixture.name, buffer, fixture.keys, concurrency)
+      console.error(`${result.fixture} x${result.concurrency}: ` +
+        `${result.mbPerSecond.toFixed(1)} MB/s, ` +
+        `p50 ${result.p50Ms.toFixed(2)} ms, p99 ${result.p99Ms.toFixed(2)} ms, ` +
+        `rss ${result.maxRssMb.toFixed(0)} MB`)
+      results.push(result)
+    }
+  }
+
+  const report = JSON.stringify({
+    commit: getCommit(),
+    date: new Date().toISOString(),
+    node: process.version,
+    platform: process.platform,
+    arch: process.arch,
+    cpus: os.cpus().length,
+    results
+  }, null, 2)
+
+  if (options.out) {
+    fs.writeFileSync(options.out, report + '\n')
+  } else {
+    console.log(report)
+  }
+}
+
+/**
+ * Decrypts a buffer over and over, with `concurrency` decryptions in flight
+ * @param {string} name
+ * @param {Buffer} buffer
+ * @param {Record<string, string>} keys
+ * @param {number} concurrency
+ * @returns {Promise<Result>}
+ */
+async function measure (name, buffer, keys, concurrency) {
+  const latencies = []
+  let maxRss = process.memoryUsage.rss()
+  let runs = 0
+  const started = performance.now()
+
+  const done = () => runs >= MAX_RUNS ||
+    (runs >= MIN_RUNS && performance.now() - started >= MIN_TIME_MS)
+
+  async function lane () {
+    while (!done()) {
+      runs++
+      const runStarted = performance.now()
+      await mp4decrypt.decrypt(buffer, keys)
+      latencies.push(performance.now() - runStarted)
+      maxRss = Math.max(maxRss, process.memoryUsage.rss())
+    }
+  }
+
+  await Promise.all(Array.from({ length: concurrency }, lane))
+  const seconds = (performance.now() - started) / 1000
+  latencies.sort((a, b) => a - b)
+
+  return {
+    fixture: name,
+    size: buffer.length,
+    concurrency,
+    runs: latencies.length,
+    mbPerSecond: latencies.length * buffer.length / 1e6 / seconds,
+    p50Ms: percentile(latencies, 0.5),
+    p99Ms: percentile(latencies, 0.99),
+    maxRssMb: maxRss / 1e6
+  }
+}
+
+/**
+ * @param {number[]} sorted
+ * @param {number} p
+ * @returns {number}
+ */
+function percentile (sorted, p) {
+  return sorted[Math.max(0, Math.ceil(p * sorted.length) - 1)]
+}
+
+/**
+ * @returns {string | null}
+ */
+function getCommit () {
+  try {
+    return execFileSync('git', ['rev-parse', 'HEAD'], { encoding: 'utf8' }).trim()
+  } catch (e) {
+    return null
+  }
+}
+
+/**
+ * @param {string[]} args
+ * @returns {{ out?: string, filter?: string }}
+ */
+function parseArgs (args) {
+  const options = {}
+  for (let i = 0; i < args.length; i++) {
+    if (args[i] === '--out') {
+      options.out = args[++i]
+    } else if (args[i] === '--filter') {
+      options.filter = args[++i]
+    } else {
+      throw new Error('Unknown argument: ' + args[i] + '\nUsage: npm run bench -- [--out results.json] [--filter name]')
+    }
+  }
+  return options
+}
@@ -1 +1,54 @@
-export function decrypt(buffer: Buffer, keyMap: Record<string, string>): Promise<Buffer>;
+import { Transform } from 'stream';
+
+export interface PhaseStats {
+  ms: number;
+  bytes: number;
+  samples: number;
+}
+
+export interface DecryptPhases {
+  parse: PhaseStats;
+  sampleTable: PhaseStats;
+  read: PhaseStats;
+  decrypt: PhaseStats;
+  write: PhaseStats;
+}
+
+export interface DecryptStats extends DecryptPhases {
+  tracks: Record<string, DecryptPhases>;
+}
+
+export interface DecryptOptions {
+  stats?: boolean;
+}
+
+export function decrypt(buffer: Buffer, keyMap: Record<string, string>, options?: DecryptOptions): Promise<Buffer & { stats?: DecryptStats }>;
+export function decryptSync(buffer: Buffer, keyMap: Record<string, string>, options?: DecryptOptions): Buffer & { stats?: DecryptStats };
+export function decryptInto(buffer: Buffer, keyMap: Record<string, string>, output: Buffer): Promise<number>;
+/** Leaves the buffer as it was if the promise rejects: it is fully checked before any of it is changed. */
+export function decryptInPlace(buffer: Buffer, keyMap: Record<string, string>): Promise<Buffer>;
+/** Rejects, returning no buffer at all, if any of the buffers fails to decrypt. */
+export function decryptMany(items: { buffer: Buffer, keys: Record<string, string> }[]): Promise<Buffer[]>;
+
+export interface PoolStats {
+  concurrency: number;
+  queued: number;
+  active: number;
+  completed: number;
+  averageQueueMs: number;
+  maxQueueMs: number;
+  averageRunMs: number;
+  maxRunMs: number;
+}
+
+export function setConcurrency(concurrency: number, options?: { affinity?: boolean }): void;
+export function getPoolStats(): PoolStats;
+
+export interface DecryptSession {
+  decrypt(segment: Buffer): Promise<Buffer>;
+  decryptInPlace(segment: Buffer): Promise<Buffer>;
+}
+
+export function createSession(options: { init: Buffer, keys: Record<string, string> }): DecryptSession;
+
+export function createDecryptStream(keyMap: Record<string, string>): Transform;
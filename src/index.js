@@ -1,16 +1,264 @@
+const { Transform } = require('stream')
 const nativeModule = require('bindings')('mp4decrypt-buffer')
 
+/**
+ * Buffers up to this size are decrypted synchronously by `decrypt`, as
+ * going through a worker thread takes longer than decrypting them
+ */
+const SYNC_DECRYPT_MAX_SIZE = 10 * 1024
+
 /**
  * Decrypts buffer with provided keys
+ *
+ * The buffer is read directly by the native worker, so it must not be
+ * modified until the returned promise settles.
  * @param {Buffer} buffer
  * @param {Record<string, string>} keyMap
+ * @param {DecryptOptions} [options]
  * @returns {Promise<Buffer>}
  */
-exports.decrypt = (buffer, keyMap) => {
+exports.decrypt = (buffer, keyMap, options = {}) => {
+  const stats = !!options.stats
+  if (Buffer.isBuffer(buffer) && buffer.length <= SYNC_DECRYPT_MAX_SIZE) {
+    try {
+      return Promise.resolve(nativeModule.decryptSync(buffer, keyMap, stats))
+    } catch (err) {
+      return Promise.reject(err)
+    }
+  }
+
   return new Promise((resolve, reject) => {
     nativeModule.decrypt(buffer, keyMap, (err, result) => {
       if (err) return reject(err)
       resolve(result)
+    }, stats)
+  })
+}
+
+/**
+ * Decrypts buffer with provided keys, on the calling thread
+ *
+ * This blocks the event loop for the whole decryption, so it is only
+ * meant for small buffers, like init or audio segments.
+ * @param {Buffer} buffer
+ * @param {Record<string, string>} keyMap
+ * @param {DecryptOptions} [options]
+ * @returns {Buffer}
+ */
+exports.decryptSync = (buffer, keyMap, options = {}) => {
+  return nativeModule.decryptSync(buffer, keyMap, !!options.stats)
+}
+
+/**
+ * @typedef {Object} DecryptOptions
+ * @property {boolean} [stats] with `stats`, the returned buffer has a
+ * `stats` property telling where the decryption time went
+ */
+
+/**
+ * Time spent, and data handled, in each phase of a decryption
+ * @typedef {Object} DecryptStats
+ * @property {PhaseStats} parse parsing the boxes of the input
+ * @property {PhaseStats} sampleTable building and walking sample tables
+ * @property {PhaseStats} read reading sample data
+ * @property {PhaseStats} decrypt decrypting sample data
+ * @property {PhaseStats} write writing the output
+ * @property {Record<string, Omit<DecryptStats, 'tracks'>>} tracks the same
+ * phases for each track, by track ID, without the work not specific to a
+ * track, like parsing
+ */
+
+/**
+ * @typedef {Object} PhaseStats
+ * @property {number} ms
+ * @property {number} bytes
+ * @property {number} samples
+ */
+
+/**
+ * Decrypts buffer with provided keys into a buffer owned by the caller
+ *
+ * No output buffer is allocated, so that output buffers can be pooled and
+ * reused. Decryption never makes media larger, so an output buffer as
+ * large as the input is always large enough. The buffers must not
+ * overlap, and must not be used until the returned promise settles.
+ * @param {Buffer} buffer
+ * @param {Record<string, string>} keyMap
+ * @param {Buffer} output
+ * @returns {Promise<number>} the number of bytes written to `output`
+ */
+exports.decryptInto = (buffer, keyMap, output) => {
+  return new Promise((resolve, reject) => {
+    nativeModule.decryptInto(buffer, keyMap, output, (err, result) => {
+      if (err) return reject(err)
+      resolve(result)
+    })
+  })
+}
+
+/**
+ * Decrypts fragmented media in place, inside the provided buffer
+ *
+ * The samples are decrypted where they are and the protection boxes are
+ * turned into `free` boxes, so the buffer keeps its size and layout.
+ * The buffer must contain the `moov` box, and must not be used until the
+ * returned promise settles. If the promise rejects, the buffer is left
+ * as it was: it is fully checked before any of it is changed.
+ * @param {Buffer} buffer
+ * @param {Record<string, string>} keyMap
+ * @returns {Promise<Buffer>} the same buffer, decrypted
+ */
+exports.decryptInPlace = (buffer, keyMap) => {
+  return new Promise((resolve, reject) => {
+    nativeModule.decryptInPlace(buffer, keyMap, (err, result) => {
+      if (err) return reject(err)
+      resolve(result)
     })
   })
 }
+
+/**
+ * Decrypts many buffers in a single native job
+ *
+ * This is much cheaper than calling `decrypt` for each buffer when the
+ * buffers are small, like audio segments. Buffers using the same keys
+ * share their expanded keys, and the buffers are decrypted on several
+ * threads. None of the buffers must be modified until the returned
+ * promise settles. The batch succeeds or fails as a whole: if any of the
+ * buffers can't be decrypted, the promise is rejected with an error
+ * naming the first one that failed, and no buffer is returned.
+ * @param {{ buffer: Buffer, keys: Record<string, string> }[]} items
+ * @returns {Promise<Buffer[]>} the decrypted buffers, in the same order
+ */
+exports.decryptMany = (items) => {
+  return new Promise((resolve, reject) => {
+    nativeModule.decryptMany(items, (err, result) => {
+      if (err) return reject(err)
+      resolve(result)
+    })
+  })
+}
+
+/**
+ * Sets the number of native threads used for decryption
+ *
+ * Decryption runs on its own thread pool rather than on the libuv
+ * threadpool, so that it does not hold up file system or DNS work.
+ * By default there is one thread per core. Changing the concurrency
+ * does not wait: the decryptions currently running finish on their
+ * threads, which then exit, while new threads take over.
+ * @param {number} concurrency
+ * @param {{ affinity?: boolean }} [options] with `affinity`, each thread
+ * is pinned to a core (Linux only)
+ */
+exports.setConcurrency = (concurrency, options = {}) => {
+  nativeModule.setConcurrency(concurrency, !!options.affinity)
+}
+
+/**
+ * Returns statistics about the native thread pool
+ * @returns {PoolStats}
+ */
+exports.getPoolStats = () => {
+  return nativeModule.getPoolStats()
+}
+
+/**
+ * @typedef {Object} PoolStats
+ * @property {number} concurrency number of threads
+ * @property {number} queued decryptions waiting for a thread
+ * @property {number} active decryptions running
+ * @property {number} completed decryptions done so far
+ * @property {number} averageQueueMs average time spent waiting for a thread
+ * @property {number} maxQueueMs longest time spent waiting for a thread
+ * @property {number} averageRunMs average time spent decrypting
+ * @property {number} maxRunMs longest time spent decrypting
+ */
+
+/**
+ * Decryption session for the media segments of a single init segment
+ *
+ * The init segment is parsed, and the keys are expanded, only once when
+ * the session is created, instead of on every call.
+ */
+class DecryptSession {
+  /**
+   * @param {Buffer} init
+   * @param {Record<string, string>} keyMap
+   */
+  constructor (init, keyMap) {
+    this._native = new nativeModule.DecryptSession(init, keyMap)
+  }
+
+  /**
+   * Decrypts a media segment
+   *
+   * The segment is read directly by the native worker, so it must not be
+   * modified until the returned promise settles.
+   * @param {Buffer} segment
+   * @returns {Promise<Buffer>}
+   */
+  decrypt (segment) {
+    return new Promise((resolve, reject) => {
+      this._native.decrypt(segment, (err, result) => {
+        if (err) return reject(err)
+        resolve(result)
+      })
+    })
+  }
+
+  /**
+   * Decrypts a media segment in place, like `decryptInPlace`, leaving it
+   * as it was if the promise rejects
+   * @param {Buffer} segment
+   * @returns {Promise<Buffer>} the same buffer, decrypted
+   */
+  decryptInPlace (segment) {
+    return new Promise((resolve, reject) => {
+      this._native.decryptInPlace(segment, (err, result) => {
+        if (err) return reject(err)
+        resolve(result)
+      })
+    })
+  }
+}
+
+/**
+ * Creates a decryption session for the media segments of an init segment
+ * @param {{ init: Buffer, keys: Record<string, string> }} options
+ * @returns {DecryptSession}
+ */
+exports.createSession = ({ init, keys }) => {
+  return new DecryptSession(init, keys)
+}
+
+/**
+ * Creates a stream decrypting fragmented media as it is read
+ *
+ * The decrypted init data is output as soon as the `moov` box has been
+ * received, and then each fragment as soon as its `mdat` box has been
+ * received, so only a single fragment is ever held in memory.
+ * @param {Record<string, string>} keyMap
+ * @returns {Transform}
+ */
+exports.createDecryptStream = (keyMap) => {
+  const decrypter = new nativeModule.DecryptStream(keyMap)
+
+  return new Transform({
+    transform (chunk, encoding, callback) {
+      decrypter.push(chunk, (err, outputs) => {
+        if (err) return callback(err)
+        for (const output of outputs) this.push(output)
+        callback()
+      })
+    },
+
+    flush (callback) {
+      decrypter.flush((err, outputs) => {
+        if (err) return callback(err)
+        for (const output of outputs) this.push(output)
+        callback()
+      })
+    }
+  })
+}
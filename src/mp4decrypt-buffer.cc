@@ -1,75 +1,1503 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
 #include <napi.h>
 #include "Ap4CommonEncryption.h"
+#include "Ap4TfraAtom.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
 
 void CleanUp(Napi::Env /*env*/, char* /*data*/, AP4_MemoryByteStream* stream) {
   if (stream) stream->Release();
 }
 
-class DecryptWorker : public Napi::AsyncWorker {
+void SetKeys(AP4_ProtectionKeyMap& key_map, std::map<std::string, std::string>& keys) {
+  std::map<std::string, std::string>::iterator it;
+
+  for (it = keys.begin(); it != keys.end(); it++) {
+    unsigned char kid[16];
+    unsigned char key[16];
+    AP4_ParseHex(it->first.c_str(), kid, 16);
+    AP4_ParseHex(it->second.c_str(), key, 16);
+    key_map.SetKeyForKid(kid, key, 16);
+  }
+}
+
+std::map<std::string, std::string> GetKeys(Napi::Object keysObject) {
+  std::map<std::string, std::string> keys;
+
+  Napi::Array kids = keysObject.GetPropertyNames();
+  for (uint32_t i = 0; i < kids.Length(); i++) {
+    Napi::String hex_kid = kids.Get(i).ToString();
+    Napi::String hex_key = keysObject.Get(hex_kid).ToString();
+    keys[hex_kid.Utf8Value()] = hex_key.Utf8Value();
+  }
+
+  return keys;
+}
+
+class PoolWorker;
+class WorkerPool;
+
+// Runs the ranges of items of a job on the threads of a WorkerPool, so that
+// large segments are decrypted on all cores without starting any thread.
+// Jobs with few items, like audio segments, are not worth splitting, and
+// run inline.
+class ThreadRunner : public AP4_Processor::ParallelRunner {
+  private:
+    WorkerPool* pool;
+    AP4_Cardinal min_items_per_range;
+
+  public:
+    ThreadRunner(WorkerPool* pool, AP4_Cardinal min_items_per_range)
+        : pool(pool), min_items_per_range(min_items_per_range) {}
+
+    AP4_Result Run(Job& job, AP4_Cardinal item_count);
+};
+
+void CompleteWorker(Napi::Env env, Napi::Function callback, std::nullptr_t* context, PoolWorker* worker);
+
+// Pool of native threads running the decryption work, so that it does not
+// compete with fs, dns and zlib for the threads of the libuv threadpool.
+// Workers are completed on the JS thread through a thread-safe function.
+// The threads also run the ranges of the jobs split by a ThreadRunner,
+// before any queued worker.
+// There is one pool per environment, stored as its instance data.
+class WorkerPool {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stats {
+      unsigned int concurrency;
+      size_t queued;
+      size_t active;
+      uint64_t completed;
+      double total_queue_ms;
+      double max_queue_ms;
+      double total_run_ms;
+      double max_run_ms;
+    };
+
+  private:
+    // ranges of a job that are run by RunRanges()
+    struct RangeSet {
+      size_t remaining;
+      AP4_Result result;
+    };
+
+    struct Range {
+      AP4_Processor::ParallelRunner::Job* job;
+      AP4_Ordinal first;
+      AP4_Cardinal count;
+      RangeSet* set;
+    };
+
+    Napi::TypedThreadSafeFunction<std::nullptr_t, PoolWorker, CompleteWorker> completion;
+    Napi::Env::CleanupHook<void (*)(WorkerPool*), WorkerPool> cleanup_hook;
+    Napi::Env env;
+    bool shut_down;
+    size_t pending;
+    ThreadRunner sample_runner;
+    ThreadRunner item_runner;
+
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::condition_variable ranges_done;
+    std::deque<PoolWorker*> queue;
+    // workers that could not be handed back to the JS thread
+    std::vector<PoolWorker*> abandoned;
+    std::deque<Range> ranges;
+    std::vector<std::thread> threads;
+    // threads replaced by SetConcurrency(), and the ones that have exited
+    std::vector<std::thread> retired;
+    std::vector<std::thread::id> exited;
+    unsigned int generation;
+    bool stopping;
+    bool affinity;
+    Stats stats;
+
+    void Start(unsigned int concurrency);
+    void StartOnce();
+    void Stop();
+    void Shutdown();
+    static void OnCleanup(WorkerPool* pool);
+    void JoinExited();
+    void Run(unsigned int index, unsigned int thread_generation, bool pinned);
+    void FinishRange(const Range& range, AP4_Result result);
+
+  public:
+    WorkerPool(Napi::Env env);
+    ~WorkerPool();
+
+    // These are only called on the JS thread
+    void Queue(PoolWorker* worker);
+    void Complete(PoolWorker* worker);
+    void SetConcurrency(unsigned int concurrency, bool affinity);
+    Stats GetStats();
+    AP4_Processor::ParallelRunner* SampleRunner();
+    AP4_Processor::ParallelRunner* ItemRunner();
+
+    // Called from any thread: runs the items of a job in ranges of at least
+    // min_items_per_range items, spread over the pool threads. The calling
+    // thread runs the first range, and the ranges no pool thread has picked
+    // up by then, so this never waits for a busy pool.
+    AP4_Result RunRanges(AP4_Processor::ParallelRunner::Job& job, AP4_Cardinal item_count, AP4_Cardinal min_items_per_range);
+};
+
+AP4_Result ThreadRunner::Run(Job& job, AP4_Cardinal item_count) {
+  return pool->RunRanges(job, item_count, min_items_per_range);
+}
+
+// Same interface as Napi::AsyncWorker, but runs on the WorkerPool
+class PoolWorker {
+  private:
+    friend class WorkerPool;
+
+    Napi::Env env;
+    Napi::FunctionReference callback;
+    WorkerPool* pool;
+    std::string error;
+    WorkerPool::Clock::time_point queued_at;
+
+  public:
+    PoolWorker(Napi::Function& function)
+        : env(function.Env()), callback(Napi::Persistent(function)),
+          pool(env.GetInstanceData<WorkerPool>()) {}
+    virtual ~PoolWorker() {}
+
+    void Queue() {
+      pool->Queue(this);
+    }
+
+    // Executed inside a pool thread.
+    virtual void Execute() = 0;
+
+    // Executed on the JS thread, once Execute() has returned.
+    virtual void OnOK() {
+      callback.Call({env.Null()});
+    }
+
+    virtual void OnError(const Napi::Error& e) {
+      callback.Call({e.Value()});
+    }
+
+  protected:
+    Napi::Env Env() {
+      return env;
+    }
+
+    Napi::FunctionReference& Callback() {
+      return callback;
+    }
+
+    WorkerPool* Pool() {
+      return pool;
+    }
+
+    void SetError(const std::string& message) {
+      error = message;
+    }
+};
+
+// Segments are split in ranges of at least 64 samples, batches in
+// ranges of single items
+WorkerPool::WorkerPool(Napi::Env env)
+    : env(env), shut_down(false), pending(0), sample_runner(this, 64), item_runner(this, 1), generation(0), stopping(false), affinity(false) {
+  stats = Stats();
+  completion = Napi::TypedThreadSafeFunction<std::nullptr_t, PoolWorker, CompleteWorker>::New(
+    env, "mp4decrypt-buffer", 0, 1);
+  // only keep the event loop alive while there is work in flight
+  completion.Unref(env);
+
+  // cleanup hooks run in reverse order, so this one runs before the one
+  // that finalizes the thread-safe function, which it still uses
+  cleanup_hook = env.AddCleanupHook(OnCleanup, this);
+}
+
+WorkerPool::~WorkerPool() {
+  if (!shut_down) {
+    cleanup_hook.Remove(env);
+    Stop();
+  }
+}
+
+void WorkerPool::OnCleanup(WorkerPool* pool) {
+  pool->Shutdown();
+}
+
+// The environment is going away: the threads are stopped before the
+// thread-safe function is released, so that none of them calls it anymore,
+// and the workers that won't call back are deleted
+void WorkerPool::Shutdown() {
+  shut_down = true;
+  Stop();
+  completion.Release();
+
+  for (size_t i = 0; i < queue.size(); i++) {
+    delete queue[i];
+  }
+  queue.clear();
+  for (size_t i = 0; i < abandoned.size(); i++) {
+    delete abandoned[i];
+  }
+  abandoned.clear();
+}
+
+// Starts one thread per core, unless the threads have been started
+void WorkerPool::StartOnce() {
+  if (threads.empty()) {
+    unsigned int concurrency = std::thread::hardware_concurrency();
+    Start(concurrency ? concurrency : 1);
+  }
+}
+
+// Starts as many of the threads as the system lets us
+void WorkerPool::Start(unsigned int concurrency) {
+  for (unsigned int i = 0; i < concurrency; i++) {
+    try {
+      threads.push_back(std::thread(&WorkerPool::Run, this, i, generation, affinity));
+    } catch (const std::system_error&) {
+      break;
+    }
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  stats.concurrency = (unsigned int)threads.size();
+}
+
+// Waits for all the threads, retired ones included, to finish the worker
+// they are running, the queued ones stay queued
+void WorkerPool::Stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    stats.concurrency = 0;
+  }
+  wakeup.notify_all();
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  threads.clear();
+  for (size_t i = 0; i < retired.size(); i++) {
+    retired[i].join();
+  }
+  retired.clear();
+  exited.clear();
+  stopping = false;
+}
+
+// Joins the retired threads that have exited, which does not block
+void WorkerPool::JoinExited() {
+  std::lock_guard<std::mutex> guard(lock);
+  for (size_t i = 0; i < retired.size();) {
+    std::vector<std::thread::id>::iterator it = std::find(exited.begin(), exited.end(), retired[i].get_id());
+    if (it == exited.end()) {
+      i++;
+      continue;
+    }
+    retired[i].join();
+    retired.erase(retired.begin() + i);
+    exited.erase(it);
+  }
+}
+
+void WorkerPool::Run(unsigned int index, unsigned int thread_generation, bool pinned) {
+#ifdef __linux__
+  if (pinned) {
+    unsigned int cores = std::thread::hardware_concurrency();
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % (cores ? cores : 1), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#else
+  (void)index;
+  (void)pinned;
+#endif
+
+  std::unique_lock<std::mutex> guard(lock);
+  for (;;) {
+    wakeup.wait(guard, [this, thread_generation]() {
+      return stopping || generation != thread_generation || !ranges.empty() || !queue.empty();
+    });
+    if (stopping) return;
+    if (generation != thread_generation) {
+      // retired by SetConcurrency()
+      exited.push_back(std::this_thread::get_id());
+      return;
+    }
+
+    // ranges first, a thread is waiting for them
+    if (!ranges.empty()) {
+      Range range = ranges.front();
+      ranges.pop_front();
+      guard.unlock();
+      AP4_Result result = range.job->Run(range.first, range.count);
+      guard.lock();
+      FinishRange(range, result);
+      continue;
+    }
+
+    PoolWorker* worker = queue.front();
+    queue.pop_front();
+    stats.active++;
+    guard.unlock();
+
+    Clock::time_point started = Clock::now();
+    worker->Execute();
+    Clock::time_point finished = Clock::now();
+    double queue_ms = std::chrono::duration<double, std::milli>(started - worker->queued_at).count();
+    double run_ms = std::chrono::duration<double, std::milli>(finished - started).count();
+
+    guard.lock();
+    stats.active--;
+    stats.completed++;
+    stats.total_queue_ms += queue_ms;
+    stats.total_run_ms += run_ms;
+    if (queue_ms > stats.max_queue_ms) stats.max_queue_ms = queue_ms;
+    if (run_ms > stats.max_run_ms) stats.max_run_ms = run_ms;
+    guard.unlock();
+
+    // the queue of the thread-safe function is unbounded, so this does
+    // not block, and the stats are up to date when the callback runs. It
+    // fails once the function is closing: the worker can't call back, and
+    // is deleted on the JS thread by Shutdown()
+    napi_status status = completion.BlockingCall(worker);
+    guard.lock();
+    if (status != napi_ok) abandoned.push_back(worker);
+  }
+}
+
+// Called with the lock held
+void WorkerPool::FinishRange(const Range& range, AP4_Result result) {
+  if (AP4_FAILED(result) && AP4_SUCCEEDED(range.set->result)) {
+    range.set->result = result;
+  }
+  if (--range.set->remaining == 0) ranges_done.notify_all();
+}
+
+AP4_Result WorkerPool::RunRanges(AP4_Processor::ParallelRunner::Job& job, AP4_Cardinal item_count, AP4_Cardinal min_items_per_range) {
+  AP4_Cardinal range_count = item_count / min_items_per_range;
+  RangeSet set;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (range_count > stats.concurrency) range_count = stats.concurrency;
+    if (range_count > 1) {
+      set.remaining = range_count - 1;
+      set.result = AP4_SUCCESS;
+      for (AP4_Cardinal i = 1; i < range_count; i++) {
+        AP4_Ordinal first = (AP4_Ordinal)((AP4_UI64)item_count * i / range_count);
+        AP4_Ordinal end = (AP4_Ordinal)((AP4_UI64)item_count * (i + 1) / range_count);
+        Range range = { &job, first, end - first, &set };
+        ranges.push_back(range);
+      }
+    }
+  }
+  if (range_count <= 1) {
+    return job.Run(0, item_count);
+  }
+  wakeup.notify_all();
+
+  AP4_Result result = job.Run(0, item_count / range_count);
+
+  std::unique_lock<std::mutex> guard(lock);
+  while (set.remaining) {
+    std::deque<Range>::iterator it = ranges.begin();
+    while (it != ranges.end() && it->set != &set) it++;
+    if (it == ranges.end()) {
+      ranges_done.wait(guard);
+      continue;
+    }
+
+    // not picked up yet: run it here rather than wait for a thread
+    Range range = *it;
+    ranges.erase(it);
+    guard.unlock();
+    AP4_Result range_result = range.job->Run(range.first, range.count);
+    guard.lock();
+    FinishRange(range, range_result);
+  }
+
+  return AP4_FAILED(result) ? result : set.result;
+}
+
+void WorkerPool::Queue(PoolWorker* worker) {
+  StartOnce();
+  if (pending++ == 0) completion.Ref(worker->env);
+  if (threads.empty()) {
+    // no thread could be started, run the worker right away
+    worker->Execute();
+    Complete(worker);
+    return;
+  }
+
+  worker->queued_at = Clock::now();
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    queue.push_back(worker);
+  }
+  wakeup.notify_one();
+}
+
+void WorkerPool::Complete(PoolWorker* worker) {
+  Napi::Env env = worker->env;
+
+#ifdef NAPI_CPP_EXCEPTIONS
+  try {
+#endif
+    if (worker->error.empty()) {
+      worker->OnOK();
+    } else {
+      worker->OnError(Napi::Error::New(env, worker->error));
+    }
+#ifdef NAPI_CPP_EXCEPTIONS
+  } catch (const Napi::Error& e) {
+    e.ThrowAsJavaScriptException();
+  }
+#endif
+  delete worker;
+
+  if (--pending == 0) completion.Unref(env);
+}
+
+// Changing the concurrency does not wait for the running workers: the
+// current threads are retired, and exit once they are done with the worker
+// they are running, while new threads take over the queue
+void WorkerPool::SetConcurrency(unsigned int concurrency, bool affinity) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    generation++;
+    stats.concurrency = 0;
+  }
+  wakeup.notify_all();
+  for (size_t i = 0; i < threads.size(); i++) {
+    retired.push_back(std::move(threads[i]));
+  }
+  threads.clear();
+  JoinExited();
+
+  this->affinity = affinity;
+  Start(concurrency);
+}
+
+// The runners may be used before any worker is queued, like by the sync
+// functions, so they start the threads
+AP4_Processor::ParallelRunner* WorkerPool::SampleRunner() {
+  StartOnce();
+  return &sample_runner;
+}
+
+AP4_Processor::ParallelRunner* WorkerPool::ItemRunner() {
+  StartOnce();
+  return &item_runner;
+}
+
+WorkerPool::Stats WorkerPool::GetStats() {
+  std::lock_guard<std::mutex> guard(lock);
+  Stats current = stats;
+  current.queued = queue.size();
+  return current;
+}
+
+void CompleteWorker(Napi::Env env, Napi::Function /*callback*/, std::nullptr_t* /*context*/, PoolWorker* worker) {
+  // the environment is going away, nothing can be called anymore
+  if (env == nullptr) return;
+
+  env.GetInstanceData<WorkerPool>()->Complete(worker);
+}
+
+// Adds up the time spent, and the bytes and samples handled, in each phase
+// of a decryption, for the whole decryption and for each track
+class DecryptStats : public AP4_Processor::Instrumentation {
+  public:
+    static const int PHASE_COUNT = PHASE_WRITE + 1;
+
+    struct Counters {
+      AP4_UI64 ns;
+      AP4_UI64 bytes;
+      AP4_UI64 samples;
+    };
+
+    struct PhaseCounters {
+      Counters phases[PHASE_COUNT];
+
+      PhaseCounters() {
+        memset(phases, 0, sizeof(phases));
+      }
+    };
+
+    AP4_UI64 GetTime() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void OnPhase(Phase phase, AP4_UI32 track_id, AP4_UI64 duration, AP4_UI64 bytes, AP4_Cardinal samples) {
+      Add(totals.phases[phase], duration, bytes, samples);
+      if (track_id) {
+        Add(tracks[track_id].phases[phase], duration, bytes, samples);
+      }
+    }
+
+    Napi::Object ToObject(Napi::Env env) const {
+      Napi::Object result = PhasesObject(env, totals);
+      Napi::Object tracks_object = Napi::Object::New(env);
+      std::map<AP4_UI32, PhaseCounters>::const_iterator it;
+      for (it = tracks.begin(); it != tracks.end(); it++) {
+        tracks_object.Set(std::to_string(it->first), PhasesObject(env, it->second));
+      }
+      result.Set("tracks", tracks_object);
+      return result;
+    }
+
+  private:
+    PhaseCounters totals;
+    std::map<AP4_UI32, PhaseCounters> tracks;
+
+    static void Add(Counters& counters, AP4_UI64 duration, AP4_UI64 bytes, AP4_Cardinal samples) {
+      counters.ns += duration;
+      counters.bytes += bytes;
+      counters.samples += samples;
+    }
+
+    static Napi::Object PhasesObject(Napi::Env env, const PhaseCounters& counters) {
+      static const char* names[PHASE_COUNT] = { "parse", "sampleTable", "read", "decrypt", "write" };
+      Napi::Object result = Napi::Object::New(env);
+      for (int i = 0; i < PHASE_COUNT; i++) {
+        Napi::Object phase = Napi::Object::New(env);
+        phase.Set("ms", Napi::Number::New(env, counters.phases[i].ns / 1e6));
+        phase.Set("bytes", Napi::Number::New(env, (double)counters.phases[i].bytes));
+        phase.Set("samples", Napi::Number::New(env, (double)counters.phases[i].samples));
+        result.Set(names[i], phase);
+      }
+      return result;
+    }
+};
+
+// Decrypts a whole file or segment into an output stream, and adds up the
+// time spent in each phase in `stats`, if not NULL
+AP4_Result ProcessData(AP4_DataBuffer& input_data, AP4_ProtectionKeyMap& key_map, AP4_Processor::ParallelRunner* runner, AP4_ByteStream& output, DecryptStats* stats) {
+  AP4_MemoryByteStream* input = new AP4_MemoryByteStream(input_data);
+
+  AP4_CencDecryptingProcessor processor(&key_map);
+  processor.SetParallelRunner(runner);
+  processor.SetInstrumentation(stats);
+  AP4_Result result = processor.Process(*input, output, NULL);
+  input->Release();
+
+  return result;
+}
+
+// Decrypts a whole file or segment into a new output stream
+AP4_Result DecryptData(AP4_DataBuffer& input_data, AP4_ProtectionKeyMap& key_map, AP4_Processor::ParallelRunner* runner, AP4_MemoryByteStream*& output, DecryptStats* stats = NULL) {
+  // decryption only removes boxes, so the output is never larger than
+  // the input: reserve it all up front so that the output is built in
+  // a single allocation, which is then handed over to JS as is
+  output = new AP4_MemoryByteStream(new AP4_DataBuffer(input_data.GetDataSize()));
+
+  return ProcessData(input_data, key_map, runner, *output, stats);
+}
+
+// Output stream writing into memory of fixed size, that remembers whether
+// some data did not fit, as the processor does not check every write
+class FixedOutputStream : public AP4_MemoryByteStream {
+  public:
+    bool overflowed;
+
+    FixedOutputStream(AP4_DataBuffer& buffer) : AP4_MemoryByteStream(buffer), overflowed(false) {}
+
+    AP4_Result WritePartial(const void* buffer, AP4_Size bytes_to_write, AP4_Size& bytes_written) {
+      AP4_Result result = AP4_MemoryByteStream::WritePartial(buffer, bytes_to_write, bytes_written);
+      if (AP4_FAILED(result) || bytes_written < bytes_to_write) {
+        overflowed = true;
+      }
+      return result;
+    }
+};
+
+// Hands an output stream over to JS, without copying it
+Napi::Buffer<char> OutputBuffer(Napi::Env env, AP4_MemoryByteStream* output) {
+  char* resultData = const_cast<char*>(reinterpret_cast<const char*>(output->GetData()));
+  return Napi::Buffer<char>::New(
+    env,
+    resultData,
+    output->GetDataSize(),
+    CleanUp,
+    output
+  );
+}
+
+class DecryptWorker : public PoolWorker {
+  private:
+    AP4_DataBuffer input_data;
+    Napi::Reference<Napi::Buffer<char>> input_ref;
+    AP4_MemoryByteStream* output;
+    AP4_ProtectionKeyMap key_map;
+    AP4_Processor::ParallelRunner* runner;
+    bool with_stats;
+    DecryptStats stats;
+
+  public:
+    DecryptWorker(Napi::Function& callback, Napi::Buffer<char> buffer, std::map<std::string, std::string>& keys, bool with_stats)
+        : PoolWorker(callback), runner(Pool()->SampleRunner()), with_stats(with_stats) {
+          input_ref = Napi::Persistent(buffer);
+          input_ref.SuppressDestruct();
+          // read the JS buffer in place: input_ref keeps it alive until the
+          // worker is done, so there is no need to copy it
+          AP4_UI08* inputData = reinterpret_cast<AP4_UI08*>(buffer.Data());
+          input_data.SetBuffer(inputData, buffer.ByteLength());
+          input_data.SetDataSize(buffer.ByteLength());
+          SetKeys(key_map, keys);
+         }
+    ~DecryptWorker() {}
+
+    // Executed inside the worker-thread.
+    // It is not safe to access JS engine data structure
+    // here, so everything we need for input and output
+    // should go on `this`.
+    void Execute() {
+      AP4_Result result = DecryptData(input_data, key_map, runner, output, with_stats ? &stats : NULL);
+
+      if (AP4_FAILED(result)) {
+        SetError("Decryption failed");
+      }
+    }
+
+    // Executed when the async work is complete
+    // this function will be run inside the main event loop
+    // so it is safe to use JS engine data again
+    void OnOK() {
+      Napi::Buffer<char> result = OutputBuffer(Env(), output);
+      if (with_stats) {
+        result.Set("stats", stats.ToObject(Env()));
+      }
+      Callback().Call({Env().Null(), result});
+      input_ref.Unref();
+    }
+
+    void OnError(const Napi::Error& e) {
+      output->Release();
+      Callback().Call({e.Value(), Env().Undefined()});
+      input_ref.Unref();
+    }
+};
+
+class DecryptIntoWorker : public PoolWorker {
+  private:
+    AP4_DataBuffer input_data;
+    AP4_DataBuffer output_data;
+    Napi::Reference<Napi::Buffer<char>> input_ref;
+    Napi::Reference<Napi::Buffer<char>> output_ref;
+    AP4_ProtectionKeyMap key_map;
+    AP4_Processor::ParallelRunner* runner;
+
+  public:
+    DecryptIntoWorker(Napi::Function& callback, Napi::Buffer<char> input, std::map<std::string, std::string>& keys, Napi::Buffer<char> output)
+        : PoolWorker(callback), runner(Pool()->SampleRunner()) {
+          input_ref = Napi::Persistent(input);
+          input_ref.SuppressDestruct();
+          output_ref = Napi::Persistent(output);
+          output_ref.SuppressDestruct();
+          input_data.SetBuffer(reinterpret_cast<AP4_UI08*>(input.Data()), input.ByteLength());
+          input_data.SetDataSize(input.ByteLength());
+          // the output data grows as it is written, up to the size of the
+          // JS buffer, which can't be reallocated
+          output_data.SetBuffer(reinterpret_cast<AP4_UI08*>(output.Data()), output.ByteLength());
+          output_data.SetDataSize(0);
+          SetKeys(key_map, keys);
+         }
+    ~DecryptIntoWorker() {}
+
+    // Executed inside the worker-thread.
+    // The output is written directly in the memory of the output buffer.
+    void Execute() {
+      FixedOutputStream* output = new FixedOutputStream(output_data);
+      AP4_Result result = ProcessData(input_data, key_map, runner, *output, NULL);
+      bool overflowed = output->overflowed;
+      output->Release();
+
+      if (overflowed) {
+        SetError("Output buffer too small");
+      } else if (AP4_FAILED(result)) {
+        SetError("Decryption failed");
+      }
+    }
+
+    void OnOK() {
+      Callback().Call({Env().Null(), Napi::Number::New(Env(), output_data.GetDataSize())});
+      input_ref.Unref();
+      output_ref.Unref();
+    }
+
+    void OnError(const Napi::Error& e) {
+      Callback().Call({e.Value(), Env().Undefined()});
+      input_ref.Unref();
+      output_ref.Unref();
+    }
+};
+
+class DecryptInPlaceWorker : public PoolWorker {
+  private:
+    AP4_UI08* data;
+    AP4_Size size;
+    Napi::Reference<Napi::Buffer<char>> buffer_ref;
+    AP4_ProtectionKeyMap key_map;
+
+  public:
+    DecryptInPlaceWorker(Napi::Function& callback, Napi::Buffer<char> buffer, std::map<std::string, std::string>& keys)
+        : PoolWorker(callback) {
+          buffer_ref = Napi::Persistent(buffer);
+          buffer_ref.SuppressDestruct();
+          data = reinterpret_cast<AP4_UI08*>(buffer.Data());
+          size = buffer.ByteLength();
+          SetKeys(key_map, keys);
+         }
+    ~DecryptInPlaceWorker() {}
+
+    // Executed inside the worker-thread.
+    // The samples are decrypted directly in the buffer's memory,
+    // and the protection boxes are turned into `free` boxes.
+    void Execute() {
+      AP4_CencDecryptingProcessor processor(&key_map);
+      AP4_Result result = processor.ProcessInPlace(data, size);
+
+      if (AP4_FAILED(result)) {
+        SetError("Decryption failed");
+      }
+    }
+
+    void OnOK() {
+      Callback().Call({Env().Null(), buffer_ref.Value()});
+      buffer_ref.Unref();
+    }
+
+    void OnError(const Napi::Error& e) {
+      Callback().Call({e.Value(), Env().Undefined()});
+      buffer_ref.Unref();
+    }
+};
+
+// Block cipher that forwards to a cipher owned by a CachingBlockCipherFactory,
+// so that the decrypters can delete it without losing the key schedule
+class SharedBlockCipher : public AP4_BlockCipher {
+  private:
+    AP4_BlockCipher* cipher;
+
+  public:
+    SharedBlockCipher(AP4_BlockCipher* cipher) : cipher(cipher) {}
+
+    CipherDirection GetDirection() {
+      return cipher->GetDirection();
+    }
+
+    AP4_Result Process(const AP4_UI08* input, AP4_Size input_size, AP4_UI08* output, const AP4_UI08* iv) {
+      return cipher->Process(input, input_size, output, iv);
+    }
+};
+
+// Keeps the expanded AES key schedules for the lifetime of a session,
+// instead of expanding the key again for every fragment.
+// The AES block ciphers hold no state once created, so they can be
+// shared by workers running at the same time.
+class CachingBlockCipherFactory : public AP4_BlockCipherFactory {
+  private:
+    std::mutex lock;
+    std::map<std::string, AP4_BlockCipher*> ciphers;
+
+  public:
+    ~CachingBlockCipherFactory() {
+      std::map<std::string, AP4_BlockCipher*>::iterator it;
+      for (it = ciphers.begin(); it != ciphers.end(); it++) {
+        delete it->second;
+      }
+    }
+
+    AP4_Result CreateCipher(AP4_BlockCipher::CipherType type,
+                            AP4_BlockCipher::CipherDirection direction,
+                            AP4_BlockCipher::CipherMode mode,
+                            const void* params,
+                            const AP4_UI08* key,
+                            AP4_Size key_size,
+                            AP4_BlockCipher*& cipher) {
+      std::string id(reinterpret_cast<const char*>(key), key_size);
+      id += static_cast<char>(type);
+      id += static_cast<char>(direction);
+      id += static_cast<char>(mode);
+      if (mode == AP4_BlockCipher::CTR && params) {
+        id += static_cast<char>(static_cast<const AP4_BlockCipher::CtrParams*>(params)->counter_size);
+      }
+
+      std::lock_guard<std::mutex> guard(lock);
+      std::map<std::string, AP4_BlockCipher*>::iterator it = ciphers.find(id);
+      if (it == ciphers.end()) {
+        AP4_BlockCipher* shared = NULL;
+        AP4_Result result = AP4_DefaultBlockCipherFactory::Instance.CreateCipher(
+          type, direction, mode, params, key, key_size, shared);
+        if (AP4_FAILED(result)) return result;
+        it = ciphers.insert(std::make_pair(id, shared)).first;
+      }
+
+      cipher = new SharedBlockCipher(it->second);
+      return AP4_SUCCESS;
+    }
+};
+
+// Decryption session for a single init segment: the init segment is parsed,
+// the track decrypters are created and the keys are expanded only once, and
+// then reused for every media segment.
+class DecryptSession : public Napi::ObjectWrap<DecryptSession> {
+  private:
+    AP4_ProtectionKeyMap key_map;
+    CachingBlockCipherFactory cipher_factory;
+    AP4_CencDecryptingProcessor processor;
+
+  public:
+    static Napi::Function Define(Napi::Env env);
+
+    DecryptSession(const Napi::CallbackInfo& info);
+
+    AP4_CencDecryptingProcessor& Processor() {
+      return processor;
+    }
+
+    Napi::Value Decrypt(const Napi::CallbackInfo& info);
+    Napi::Value DecryptInPlace(const Napi::CallbackInfo& info);
+};
+
+class SessionDecryptWorker : public PoolWorker {
+  private:
+    DecryptSession* session;
+    Napi::ObjectReference session_ref;
+    AP4_DataBuffer input_data;
+    Napi::Reference<Napi::Buffer<char>> input_ref;
+    AP4_MemoryByteStream* output;
+    bool in_place;
+
+  public:
+    SessionDecryptWorker(Napi::Function& callback, DecryptSession* session, Napi::Buffer<char> buffer, bool in_place)
+        : PoolWorker(callback), session(session), output(NULL), in_place(in_place) {
+          // keep the session alive until the worker is done with it
+          session_ref = Napi::Persistent(session->Value());
+          session_ref.SuppressDestruct();
+          input_ref = Napi::Persistent(buffer);
+          input_ref.SuppressDestruct();
+          input_data.SetBuffer(reinterpret_cast<AP4_UI08*>(buffer.Data()), buffer.ByteLength());
+          input_data.SetDataSize(buffer.ByteLength());
+         }
+    ~SessionDecryptWorker() {}
+
+    // Executed inside the worker-thread.
+    // Only the segment itself is parsed here, the init segment
+    // has already been loaded by the session.
+    void Execute() {
+      AP4_Result result;
+
+      if (in_place) {
+        result = session->Processor().ProcessInPlace(input_data.UseData(), input_data.GetDataSize());
+      } else {
+        AP4_MemoryByteStream* input = new AP4_MemoryByteStream(input_data);
+        output = new AP4_MemoryByteStream(new AP4_DataBuffer(input_data.GetDataSize()));
+        result = session->Processor().ProcessFragments(*input, *output);
+        input->Release();
+      }
+
+      if (AP4_FAILED(result)) {
+        SetError("Decryption failed");
+      }
+    }
+
+    void OnOK() {
+      if (in_place) {
+        Callback().Call({Env().Null(), input_ref.Value()});
+      } else {
+        Callback().Call({Env().Null(), OutputBuffer(Env(), output)});
+      }
+      input_ref.Unref();
+      session_ref.Unref();
+    }
+
+    void OnError(const Napi::Error& e) {
+      if (output) output->Release();
+      Callback().Call({e.Value(), Env().Undefined()});
+      input_ref.Unref();
+      session_ref.Unref();
+    }
+};
+
+Napi::Function DecryptSession::Define(Napi::Env env) {
+  return DefineClass(env, "DecryptSession", {
+    InstanceMethod("decrypt", &DecryptSession::Decrypt),
+    InstanceMethod("decryptInPlace", &DecryptSession::DecryptInPlace)
+  });
+}
+
+DecryptSession::DecryptSession(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<DecryptSession>(info), processor(&key_map, &cipher_factory) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+
+  if (!info[0].IsBuffer() || !info[1].IsObject()) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+
+  std::map<std::string, std::string> keys = GetKeys(info[1].As<Napi::Object>());
+  SetKeys(key_map, keys);
+
+  // the init segment is small, and fully parsed here, so it is
+  // simply copied instead of keeping the JS buffer alive
+  Napi::Buffer<char> init = info[0].As<Napi::Buffer<char>>();
+  AP4_MemoryByteStream* input = new AP4_MemoryByteStream(
+    reinterpret_cast<const AP4_UI08*>(init.Data()),
+    init.ByteLength()
+  );
+  processor.SetParallelRunner(env.GetInstanceData<WorkerPool>()->SampleRunner());
+  AP4_Result result = processor.LoadInit(*input);
+  input->Release();
+
+  if (AP4_FAILED(result)) {
+    Napi::Error::New(env, "Invalid init segment")
+        .ThrowAsJavaScriptException();
+  }
+}
+
+Napi::Value DecryptSession::Decrypt(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (!info[0].IsBuffer() || !info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char>>();
+  Napi::Function callback = info[1].As<Napi::Function>();
+
+  SessionDecryptWorker* worker = new SessionDecryptWorker(callback, this, buffer, false);
+  worker->Queue();
+
+  return env.Undefined();
+}
+
+Napi::Value DecryptSession::DecryptInPlace(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (!info[0].IsBuffer() || !info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char>>();
+  Napi::Function callback = info[1].As<Napi::Function>();
+
+  SessionDecryptWorker* worker = new SessionDecryptWorker(callback, this, buffer, true);
+  worker->Queue();
+
+  return env.Undefined();
+}
+
+// Decrypts a fragmented file received in chunks: the init data is output
+// as soon as the moov box is complete, and each fragment as soon as its
+// mdat box is complete, so that only a single fragment is ever buffered.
+class StreamDecrypter {
+  private:
+    AP4_ProtectionKeyMap key_map;
+    CachingBlockCipherFactory cipher_factory;
+    AP4_CencDecryptingProcessor processor;
+    // data not processed yet, starting on a box boundary
+    AP4_DataBuffer pending;
+    // end of the complete boxes found in the pending data
+    AP4_Size scanned;
+    bool init_loaded;
+
+    // the fragments are smaller once decrypted, so the offsets of the
+    // random access index, in the mfra box at the end of the file, are
+    // updated like AP4_Processor::Process() does
+    AP4_UI64 input_offset;
+    AP4_UI64 output_offset;
+    std::vector<AP4_UI64> pending_moofs;
+    std::map<AP4_UI64, AP4_UI64> moof_offsets;
+
+    AP4_Result ProcessPending(std::vector<AP4_MemoryByteStream*>& outputs);
+    AP4_Result UpdateOffsets(AP4_MemoryByteStream& output);
+    AP4_Result UpdateMfra(AP4_MemoryByteStream& output, AP4_Position position);
+
+  public:
+    StreamDecrypter(std::map<std::string, std::string>& keys, AP4_Processor::ParallelRunner* runner);
+
+    AP4_Result Push(const AP4_UI08* data, AP4_Size size, std::vector<AP4_MemoryByteStream*>& outputs);
+    AP4_Result Flush(std::vector<AP4_MemoryByteStream*>& outputs);
+};
+
+StreamDecrypter::StreamDecrypter(std::map<std::string, std::string>& keys, AP4_Processor::ParallelRunner* runner)
+    : processor(&key_map, &cipher_factory), scanned(0), init_loaded(false),
+      input_offset(0), output_offset(0) {
+  SetKeys(key_map, keys);
+  processor.SetParallelRunner(runner);
+}
+
+// Decrypts the complete boxes of the pending data, and drops them
+AP4_Result StreamDecrypter::ProcessPending(std::vector<AP4_MemoryByteStream*>& outputs) {
+  AP4_DataBuffer boxes;
+  boxes.SetBuffer(pending.UseData(), scanned);
+  boxes.SetDataSize(scanned);
+  AP4_MemoryByteStream* input = new AP4_MemoryByteStream(boxes);
+  AP4_MemoryByteStream* output = new AP4_MemoryByteStream(new AP4_DataBuffer(scanned));
+  outputs.push_back(output);
+
+  AP4_Result result;
+  if (init_loaded) {
+    result = processor.ProcessFragments(*input, *output);
+    if (AP4_SUCCEEDED(result)) result = UpdateOffsets(*output);
+  } else {
+    result = processor.LoadInit(*input, output);
+    init_loaded = AP4_SUCCEEDED(result);
+  }
+  input->Release();
+  if (AP4_FAILED(result)) return result;
+  input_offset += scanned;
+  output_offset += output->GetDataSize();
+
+  // the buffer is kept, so it only grows up to the largest fragment
+  AP4_Size left = pending.GetDataSize() - scanned;
+  memmove(pending.UseData(), pending.GetData() + scanned, left);
+  pending.SetDataSize(left);
+  scanned = 0;
+
+  return AP4_SUCCESS;
+}
+
+// Maps the moof boxes of the pending data to the ones of the output,
+// and updates the mfra boxes of the output with the new offsets
+AP4_Result StreamDecrypter::UpdateOffsets(AP4_MemoryByteStream& output) {
+  const AP4_UI08* data = output.GetData();
+  AP4_Size size = output.GetDataSize();
+  size_t moof_index = 0;
+
+  for (AP4_Size position = 0; size - position >= AP4_ATOM_HEADER_SIZE;) {
+    AP4_UI64 box_size = AP4_BytesToUInt32BE(data + position);
+    AP4_UI32 type = AP4_BytesToUInt32BE(data + position + 4);
+    if (box_size == 1 && size - position >= AP4_ATOM_HEADER_SIZE_64) {
+      box_size = AP4_BytesToUInt64BE(data + position + 8);
+    } else if (box_size == 0) {
+      box_size = size - position;
+    }
+    if (box_size < AP4_ATOM_HEADER_SIZE || box_size > size - position) return AP4_ERROR_INVALID_FORMAT;
+
+    if (type == AP4_ATOM_TYPE_MOOF && moof_index < pending_moofs.size()) {
+      moof_offsets[pending_moofs[moof_index++]] = output_offset + position;
+    } else if (type == AP4_ATOM_TYPE_MFRA) {
+      AP4_Result result = UpdateMfra(output, position);
+      if (AP4_FAILED(result)) return result;
+    }
+    position += (AP4_Size)box_size;
+  }
+  pending_moofs.clear();
+
+  return AP4_SUCCESS;
+}
+
+// The offsets only get smaller, so the mfra box keeps its size
+// and is rewritten where it is
+AP4_Result StreamDecrypter::UpdateMfra(AP4_MemoryByteStream& output, AP4_Position position) {
+  AP4_Atom* atom = NULL;
+  output.Seek(position);
+  AP4_Result result = AP4_DefaultAtomFactory::Instance_.CreateAtomFromStream(output, atom);
+  if (AP4_FAILED(result)) return result;
+
+  AP4_ContainerAtom* mfra = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
+  if (mfra) {
+    for (AP4_List<AP4_Atom>::Item* item = mfra->GetChildren().FirstItem(); item; item = item->GetNext()) {
+      AP4_TfraAtom* tfra = AP4_DYNAMIC_CAST(AP4_TfraAtom, item->GetData());
+      if (tfra == NULL) continue;
+      AP4_Array<AP4_TfraAtom::Entry>& entries = tfra->GetEntries();
+      for (unsigned int i = 0; i < entries.ItemCount(); i++) {
+        std::map<AP4_UI64, AP4_UI64>::iterator it = moof_offsets.find(entries[i].m_MoofOffset);
+        if (it != moof_offsets.end()) entries[i].m_MoofOffset = it->second;
+      }
+    }
+  }
+
+  output.Seek(position);
+  result = atom->Write(output);
+  delete atom;
+  return result;
+}
+
+AP4_Result StreamDecrypter::Push(const AP4_UI08* data, AP4_Size size, std::vector<AP4_MemoryByteStream*>& outputs) {
+  // chunks are usually much smaller than fragments: let the buffer
+  // grow geometrically instead of reallocating it for every chunk
+  AP4_Result result = pending.Reserve(pending.GetDataSize() + size);
+  if (AP4_FAILED(result)) return result;
+  pending.AppendData(data, size);
+
+  for (;;) {
+    const AP4_UI08* header = pending.GetData() + scanned;
+    AP4_Size available = pending.GetDataSize() - scanned;
+    if (available < AP4_ATOM_HEADER_SIZE) return AP4_SUCCESS;
+
+    AP4_UI64 box_size = AP4_BytesToUInt32BE(header);
+    AP4_UI32 type = AP4_BytesToUInt32BE(header + 4);
+    if (box_size == 1) {
+      if (available < AP4_ATOM_HEADER_SIZE_64) return AP4_SUCCESS;
+      box_size = AP4_BytesToUInt64BE(header + 8);
+      if (box_size < AP4_ATOM_HEADER_SIZE_64) return AP4_ERROR_INVALID_FORMAT;
+    } else if (box_size == 0) {
+      // the box extends to the end of the stream
+      return AP4_SUCCESS;
+    } else if (box_size < AP4_ATOM_HEADER_SIZE) {
+      return AP4_ERROR_INVALID_FORMAT;
+    }
+    if (box_size > 0xFFFFFFFF - scanned) return AP4_ERROR_OUT_OF_RANGE;
+    if (box_size > available) return AP4_SUCCESS;
+    if (type == AP4_ATOM_TYPE_MOOF) pending_moofs.push_back(input_offset + scanned);
+    scanned += (AP4_Size)box_size;
+
+    if ((!init_loaded && type == AP4_ATOM_TYPE_MOOV) ||
+        (init_loaded && type == AP4_ATOM_TYPE_MDAT)) {
+      result = ProcessPending(outputs);
+      if (AP4_FAILED(result)) return result;
+    }
+  }
+}
+
+AP4_Result StreamDecrypter::Flush(std::vector<AP4_MemoryByteStream*>& outputs) {
+  AP4_Size available = pending.GetDataSize() - scanned;
+  if (available) {
+    // only a box extending to the end of the stream can be left over
+    if (available < AP4_ATOM_HEADER_SIZE || AP4_BytesToUInt32BE(pending.GetData() + scanned) != 0) {
+      return AP4_ERROR_EOS;
+    }
+    scanned += available;
+  }
+
+  if (scanned) {
+    AP4_Result result = ProcessPending(outputs);
+    if (AP4_FAILED(result)) return result;
+  }
+
+  return init_loaded ? AP4_SUCCESS : AP4_ERROR_INVALID_FORMAT;
+}
+
+class DecryptStream : public Napi::ObjectWrap<DecryptStream> {
+  private:
+    StreamDecrypter* decrypter;
+    bool busy;
+
+    Napi::Value Queue(const Napi::CallbackInfo& info, Napi::Buffer<char>* chunk, Napi::Function callback);
+
+  public:
+    static Napi::Function Define(Napi::Env env);
+
+    DecryptStream(const Napi::CallbackInfo& info);
+    ~DecryptStream();
+
+    StreamDecrypter& Decrypter() {
+      return *decrypter;
+    }
+
+    void SetBusy(bool busy) {
+      this->busy = busy;
+    }
+
+    Napi::Value Push(const Napi::CallbackInfo& info);
+    Napi::Value Flush(const Napi::CallbackInfo& info);
+};
+
+class StreamDecryptWorker : public PoolWorker {
   private:
-    AP4_MemoryByteStream* input;
+    DecryptStream* stream;
+    Napi::ObjectReference stream_ref;
+    AP4_DataBuffer input_data;
     Napi::Reference<Napi::Buffer<char>> input_ref;
-    AP4_MemoryByteStream* output;
-    AP4_ProtectionKeyMap key_map;
+    bool flush;
+    std::vector<AP4_MemoryByteStream*> outputs;
 
   public:
-    DecryptWorker(Napi::Function& callback, Napi::Buffer<char> buffer, std::map<std::string, std::string>& keys)
-        : Napi::AsyncWorker(callback) {
-          input_ref = Napi::Persistent(buffer);
-          input_ref.SuppressDestruct();
-          AP4_UI08* inputData = reinterpret_cast<AP4_UI08*>(buffer.Data());
-          input = new AP4_MemoryByteStream(inputData, buffer.ByteLength());
-          std::map<std::string, std::string>::iterator it;
-
-          for (it = keys.begin(); it != keys.end(); it++) {
-            unsigned char kid[16];
-            unsigned char key[16];
-            AP4_ParseHex(it->first.c_str(), kid, 16);
-            AP4_ParseHex(it->second.c_str(), key, 16);
-            key_map.SetKeyForKid(kid, key, 16);
+    StreamDecryptWorker(Napi::Function& callback, DecryptStream* stream, Napi::Buffer<char>* chunk)
+        : PoolWorker(callback), stream(stream), flush(chunk == NULL) {
+          // keep the stream alive until the worker is done with it
+          stream_ref = Napi::Persistent(stream->Value());
+          stream_ref.SuppressDestruct();
+          if (chunk) {
+            input_ref = Napi::Persistent(*chunk);
+            input_ref.SuppressDestruct();
+            input_data.SetBuffer(reinterpret_cast<AP4_UI08*>(chunk->Data()), chunk->ByteLength());
+            input_data.SetDataSize(chunk->ByteLength());
           }
          }
-    ~DecryptWorker() {}
+    ~StreamDecryptWorker() {
+      for (size_t i = 0; i < outputs.size(); i++) {
+        if (outputs[i]) outputs[i]->Release();
+      }
+    }
 
     // Executed inside the worker-thread.
-    // It is not safe to access JS engine data structure
-    // here, so everything we need for input and output
-    // should go on `this`.
+    // The chunk is copied into the stream's pending data, and
+    // the boxes it completes are decrypted.
     void Execute() {
-      input->Seek(0);
-      output = new AP4_MemoryByteStream();
+      AP4_Result result;
 
-      AP4_Processor* processor = new AP4_CencDecryptingProcessor(&key_map);
-      AP4_Result result = processor->Process(*input, *output, NULL);
-      delete processor;
-      input->Release();
+      if (flush) {
+        result = stream->Decrypter().Flush(outputs);
+      } else {
+        result = stream->Decrypter().Push(input_data.GetData(), input_data.GetDataSize(), outputs);
+      }
 
       if (AP4_FAILED(result)) {
         SetError("Decryption failed");
       }
     }
 
-    // Executed when the async work is complete
-    // this function will be run inside the main event loop
-    // so it is safe to use JS engine data again
     void OnOK() {
-      char* resultData = const_cast<char*>(reinterpret_cast<const char*>(output->GetData()));
-      Napi::Buffer<char> outBuffer = Napi::Buffer<char>::New(
-        Env(),
-        resultData,
-        output->GetDataSize(),
-        CleanUp,
-        output
-      );
-
-      Callback().Call({Env().Null(), outBuffer});
-      input_ref.Unref();
+      Napi::Array results = Napi::Array::New(Env(), outputs.size());
+      for (size_t i = 0; i < outputs.size(); i++) {
+        results.Set(static_cast<uint32_t>(i), OutputBuffer(Env(), outputs[i]));
+        // the JS buffer owns the output now
+        outputs[i] = NULL;
+      }
+
+      stream->SetBusy(false);
+      Callback().Call({Env().Null(), results});
+      if (!flush) input_ref.Unref();
+      stream_ref.Unref();
     }
 
     void OnError(const Napi::Error& e) {
+      stream->SetBusy(false);
       Callback().Call({e.Value(), Env().Undefined()});
-      input_ref.Unref();
+      if (!flush) input_ref.Unref();
+      stream_ref.Unref();
+    }
+};
+
+Napi::Function DecryptStream::Define(Napi::Env env) {
+  return DefineClass(env, "DecryptStream", {
+    InstanceMethod("push", &DecryptStream::Push),
+    InstanceMethod("flush", &DecryptStream::Flush)
+  });
+}
+
+DecryptStream::DecryptStream(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<DecryptStream>(info), decrypter(NULL), busy(false) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+
+  if (!info[0].IsObject()) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+
+  std::map<std::string, std::string> keys = GetKeys(info[0].As<Napi::Object>());
+  decrypter = new StreamDecrypter(keys, env.GetInstanceData<WorkerPool>()->SampleRunner());
+}
+
+DecryptStream::~DecryptStream() {
+  delete decrypter;
+}
+
+// Chunks must be pushed one at a time, as they are decrypted in order
+Napi::Value DecryptStream::Queue(const Napi::CallbackInfo& info, Napi::Buffer<char>* chunk, Napi::Function callback) {
+  Napi::Env env = info.Env();
+
+  if (busy) {
+    Napi::Error::New(env, "A chunk is already being decrypted")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  busy = true;
+
+  StreamDecryptWorker* worker = new StreamDecryptWorker(callback, this, chunk);
+  worker->Queue();
+
+  return env.Undefined();
+}
+
+Napi::Value DecryptStream::Push(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (!info[0].IsBuffer() || !info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Buffer<char> chunk = info[0].As<Napi::Buffer<char>>();
+  return Queue(info, &chunk, info[1].As<Napi::Function>());
+}
+
+Napi::Value DecryptStream::Flush(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (!info[0].IsFunction()) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  return Queue(info, NULL, info[0].As<Napi::Function>());
+}
+
+// Decrypts a whole batch of buffers in a single job, so that the cost
+// of dispatching the work is paid once per batch instead of per buffer.
+// The items are spread over the pool threads.
+// The batch fails as a whole if any of its items fails.
+class DecryptManyWorker : public PoolWorker, public AP4_Processor::ParallelRunner::Job {
+  private:
+    // items using the same keys share the key map and key schedules
+    struct KeySet {
+      AP4_ProtectionKeyMap key_map;
+      CachingBlockCipherFactory cipher_factory;
+    };
+
+    struct Item {
+      AP4_DataBuffer input_data;
+      Napi::Reference<Napi::Buffer<char>> input_ref;
+      KeySet* key_set;
+      AP4_MemoryByteStream* output;
+      AP4_Result result;
+    };
+
+    std::vector<Item*> items;
+    std::map<std::string, KeySet*> key_sets;
+    AP4_Processor::ParallelRunner* item_runner;
+    AP4_Processor::ParallelRunner* sample_runner;
+
+    void Unref() {
+      for (size_t i = 0; i < items.size(); i++) {
+        items[i]->input_ref.Unref();
+      }
+    }
+
+  public:
+    DecryptManyWorker(Napi::Function& callback, Napi::Array array)
+        : PoolWorker(callback), item_runner(Pool()->ItemRunner()), sample_runner(Pool()->SampleRunner()) {
+          for (uint32_t i = 0; i < array.Length(); i++) {
+            Napi::Object object = array.Get(i).As<Napi::Object>();
+            Napi::Buffer<char> buffer = object.Get("buffer").As<Napi::Buffer<char>>();
+            std::map<std::string, std::string> keys = GetKeys(object.Get("keys").As<Napi::Object>());
+
+            std::string id;
+            std::map<std::string, std::string>::iterator it;
+            for (it = keys.begin(); it != keys.end(); it++) {
+              id += it->first + ":" + it->second + ",";
+            }
+            KeySet*& key_set = key_sets[id];
+            if (key_set == NULL) {
+              key_set = new KeySet();
+              SetKeys(key_set->key_map, keys);
+            }
+
+            // keep each buffer alive itself, the caller may change the array
+            Item* item = new Item();
+            item->input_ref = Napi::Persistent(buffer);
+            item->input_ref.SuppressDestruct();
+            item->input_data.SetBuffer(reinterpret_cast<AP4_UI08*>(buffer.Data()), buffer.ByteLength());
+            item->input_data.SetDataSize(buffer.ByteLength());
+            item->key_set = key_set;
+            item->output = NULL;
+            item->result = AP4_SUCCESS;
+            items.push_back(item);
+          }
+         }
+    ~DecryptManyWorker() {
+      for (size_t i = 0; i < items.size(); i++) {
+        if (items[i]->output) items[i]->output->Release();
+        delete items[i];
+      }
+      std::map<std::string, KeySet*>::iterator it;
+      for (it = key_sets.begin(); it != key_sets.end(); it++) {
+        delete it->second;
+      }
+    }
+
+    // Executed inside the worker-thread.
+    void Execute() {
+      item_runner->Run(*this, (AP4_Cardinal)items.size());
+
+      for (size_t i = 0; i < items.size(); i++) {
+        if (AP4_FAILED(items[i]->result)) {
+          SetError("Decryption failed for item " + std::to_string(i));
+          return;
+        }
+      }
+    }
+
+    // Executed inside the pool threads, for a range of items.
+    AP4_Result Run(AP4_Ordinal first, AP4_Cardinal count) {
+      for (AP4_Ordinal i = first; i < first + count; i++) {
+        Item* item = items[i];
+        AP4_MemoryByteStream* input = new AP4_MemoryByteStream(item->input_data);
+        item->output = new AP4_MemoryByteStream(new AP4_DataBuffer(item->input_data.GetDataSize()));
+
+        AP4_CencDecryptingProcessor processor(&item->key_set->key_map, &item->key_set->cipher_factory);
+        processor.SetParallelRunner(sample_runner);
+        item->result = processor.Process(*input, *item->output, NULL);
+        input->Release();
+      }
+      return AP4_SUCCESS;
+    }
+
+    void OnOK() {
+      Napi::Array results = Napi::Array::New(Env(), items.size());
+      for (size_t i = 0; i < items.size(); i++) {
+        results.Set(static_cast<uint32_t>(i), OutputBuffer(Env(), items[i]->output));
+        // the JS buffer owns the output now
+        items[i]->output = NULL;
+      }
+
+      Callback().Call({Env().Null(), results});
+      Unref();
+    }
+
+    void OnError(const Napi::Error& e) {
+      Callback().Call({e.Value(), Env().Undefined()});
+      Unref();
     }
 };
 
@@ -82,6 +1510,113 @@ Napi::Value Decrypt(const Napi::CallbackInfo& info) {
     return env.Null();
   }
 
+  if (!info[0].IsBuffer() || !info[1].IsObject() || !info[2].IsFunction() ||
+      (info.Length() > 3 && !info[3].IsBoolean())) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char>>();
+  Napi::Function callback = info[2].As<Napi::Function>();
+  std::map<std::string, std::string> keys = GetKeys(info[1].As<Napi::Object>());
+  bool with_stats = info.Length() > 3 && info[3].As<Napi::Boolean>().Value();
+
+  DecryptWorker* worker = new DecryptWorker(callback, buffer, keys, with_stats);
+  worker->Queue();
+
+  return env.Undefined();
+}
+
+Napi::Value DecryptSync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (!info[0].IsBuffer() || !info[1].IsObject() ||
+      (info.Length() > 2 && !info[2].IsBoolean())) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char>>();
+  std::map<std::string, std::string> keys = GetKeys(info[1].As<Napi::Object>());
+  AP4_ProtectionKeyMap key_map;
+  SetKeys(key_map, keys);
+  bool with_stats = info.Length() > 2 && info[2].As<Napi::Boolean>().Value();
+  DecryptStats stats;
+
+  AP4_DataBuffer input_data;
+  input_data.SetBuffer(reinterpret_cast<AP4_UI08*>(buffer.Data()), buffer.ByteLength());
+  input_data.SetDataSize(buffer.ByteLength());
+
+  AP4_MemoryByteStream* output = NULL;
+  // runs inline on the calling thread, without handing any work to the
+  // pool, where it could wait behind the async jobs
+  AP4_Result result = DecryptData(input_data, key_map, NULL, output, with_stats ? &stats : NULL);
+  if (AP4_FAILED(result)) {
+    output->Release();
+    Napi::Error::New(env, "Decryption failed")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Buffer<char> result_buffer = OutputBuffer(env, output);
+  if (with_stats) {
+    result_buffer.Set("stats", stats.ToObject(env));
+  }
+  return result_buffer;
+}
+
+Napi::Value DecryptInto(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 4) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (!info[0].IsBuffer() || !info[1].IsObject() || !info[2].IsBuffer() || !info[3].IsFunction()) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+  Napi::Buffer<char> output = info[2].As<Napi::Buffer<char>>();
+  Napi::Function callback = info[3].As<Napi::Function>();
+
+  // the input is read while the output is written
+  if (output.Data() < input.Data() + input.ByteLength() &&
+      input.Data() < output.Data() + output.ByteLength()) {
+    Napi::RangeError::New(env, "The output buffer must not overlap the input buffer")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::map<std::string, std::string> keys = GetKeys(info[1].As<Napi::Object>());
+
+  DecryptIntoWorker* worker = new DecryptIntoWorker(callback, input, keys, output);
+  worker->Queue();
+
+  return env.Undefined();
+}
+
+Napi::Value DecryptInPlace(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
   if (!info[0].IsBuffer() || !info[1].IsObject() || !info[2].IsFunction()) {
     Napi::TypeError::New(env, "Wrong arguments")
         .ThrowAsJavaScriptException();
@@ -89,27 +1624,115 @@ Napi::Value Decrypt(const Napi::CallbackInfo& info) {
   }
 
   Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char>>();
-  Napi::Object keysObject = info[1].As<Napi::Object>();
   Napi::Function callback = info[2].As<Napi::Function>();
+  std::map<std::string, std::string> keys = GetKeys(info[1].As<Napi::Object>());
 
-  std::map<std::string, std::string> keys;
+  DecryptInPlaceWorker* worker = new DecryptInPlaceWorker(callback, buffer, keys);
+  worker->Queue();
 
-  Napi::Array kids = keysObject.GetPropertyNames();
-  for (uint32_t i = 0; i < kids.Length(); i++) {
-    Napi::String hex_kid = kids.Get(i).ToString();
-    Napi::String hex_key = keysObject.Get(hex_kid).ToString();
-    keys[hex_kid.Utf8Value()] = hex_key.Utf8Value();
+  return env.Undefined();
+}
+
+Napi::Value DecryptMany(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (!info[0].IsArray() || !info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Array array = info[0].As<Napi::Array>();
+  for (uint32_t i = 0; i < array.Length(); i++) {
+    Napi::Value item = array.Get(i);
+    if (!item.IsObject() ||
+        !item.As<Napi::Object>().Get("buffer").IsBuffer() ||
+        !item.As<Napi::Object>().Get("keys").IsObject()) {
+      Napi::TypeError::New(env, "Wrong arguments")
+          .ThrowAsJavaScriptException();
+      return env.Null();
+    }
   }
 
-  DecryptWorker* worker = new DecryptWorker(callback, buffer, keys);
+  Napi::Function callback = info[1].As<Napi::Function>();
+
+  DecryptManyWorker* worker = new DecryptManyWorker(callback, array);
   worker->Queue();
 
   return env.Undefined();
 }
 
+Napi::Value SetConcurrency(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Wrong number of arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (!info[0].IsNumber() || (info.Length() > 1 && !info[1].IsBoolean())) {
+    Napi::TypeError::New(env, "Wrong arguments")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  int32_t concurrency = info[0].As<Napi::Number>().Int32Value();
+  if (concurrency < 1) {
+    Napi::RangeError::New(env, "Concurrency must be at least 1")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  bool affinity = info.Length() > 1 && info[1].As<Napi::Boolean>().Value();
+
+  env.GetInstanceData<WorkerPool>()->SetConcurrency(concurrency, affinity);
+
+  return env.Undefined();
+}
+
+Napi::Value GetPoolStats(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  WorkerPool::Stats stats = env.GetInstanceData<WorkerPool>()->GetStats();
+
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("concurrency", Napi::Number::New(env, stats.concurrency));
+  result.Set("queued", Napi::Number::New(env, stats.queued));
+  result.Set("active", Napi::Number::New(env, stats.active));
+  result.Set("completed", Napi::Number::New(env, stats.completed));
+  result.Set("averageQueueMs", Napi::Number::New(env, stats.completed ? stats.total_queue_ms / stats.completed : 0));
+  result.Set("maxQueueMs", Napi::Number::New(env, stats.max_queue_ms));
+  result.Set("averageRunMs", Napi::Number::New(env, stats.completed ? stats.total_run_ms / stats.completed : 0));
+  result.Set("maxRunMs", Napi::Number::New(env, stats.max_run_ms));
+  return result;
+}
+
 Napi::Object Init (Napi::Env env, Napi::Object exports) {
+  env.SetInstanceData(new WorkerPool(env));
+
   exports.Set(Napi::String::New(env, "decrypt"),
               Napi::Function::New(env, Decrypt));
+  exports.Set(Napi::String::New(env, "decryptSync"),
+              Napi::Function::New(env, DecryptSync));
+  exports.Set(Napi::String::New(env, "decryptInto"),
+              Napi::Function::New(env, DecryptInto));
+  exports.Set(Napi::String::New(env, "decryptInPlace"),
+              Napi::Function::New(env, DecryptInPlace));
+  exports.Set(Napi::String::New(env, "decryptMany"),
+              Napi::Function::New(env, DecryptMany));
+  exports.Set(Napi::String::New(env, "DecryptSession"),
+              DecryptSession::Define(env));
+  exports.Set(Napi::String::New(env, "DecryptStream"),
+              DecryptStream::Define(env));
+  exports.Set(Napi::String::New(env, "setConcurrency"),
+              Napi::Function::New(env, SetConcurrency));
+  exports.Set(Napi::String::New(env, "getPoolStats"),
+              Napi::Function::New(env, GetPoolStats));
   return exports;
 }
 
@@ -29,6 +29,8 @@ const tests = [
 main()
 
 async function main () {
+  mp4decrypt.setConcurrency(2)
+
   for (let i = 0; i < tests.length; i++) {
     try {
       await doTest(tests[i])
@@ -38,6 +40,11 @@ async function main () {
     }
   }
 
+  const stats = mp4decrypt.getPoolStats()
+  if (stats.concurrency !== 2 || stats.queued !== 0 || stats.active !== 0 || stats.completed === 0) {
+    throw new Error('Unexpected pool stats: ' + JSON.stringify(stats))
+  }
+
   console.info('All tests passed!')
 }
 
@@ -55,6 +62,109 @@ async function doTest (t) {
   if (!compareSamples(srcSamples, decSamples)) {
     throw new Error('Samples did not match')
   }
+
+  if (!compareSamples(srcSamples, await getSamples(mp4decrypt.decryptSync(encrypted, t.keys)))) {
+    throw new Error('Sync samples did not match')
+  }
+
+  const withStats = await mp4decrypt.decrypt(encrypted, t.keys, { stats: true })
+  if (!compareSamples(srcSamples, await getSamples(withStats))) {
+    throw new Error('Samples decrypted with stats did not match')
+  }
+  const { stats } = /** @type {any} */ (withStats)
+  const decryptedSize = Object.values(stats.tracks).reduce((sum, track) => sum + track.decrypt.bytes, 0)
+  if (stats.parse.bytes !== encrypted.length || decryptedSize === 0 || stats.decrypt.bytes !== decryptedSize) {
+    throw new Error('Unexpected decrypt stats: ' + JSON.stringify(stats))
+  }
+
+  const into = Buffer.alloc(encrypted.length)
+  const written = await mp4decrypt.decryptInto(encrypted, t.keys, into)
+  if (!into.subarray(0, written).equals(decrypted)) {
+    throw new Error('Output decrypted into a buffer did not match')
+  }
+  const tooSmall = await mp4decrypt.decryptInto(encrypted, t.keys, Buffer.alloc(written - 1)).then(() => false, () => true)
+  if (!tooSmall) {
+    throw new Error('Decrypting into a buffer too small did not fail')
+  }
+
+  const inPlace = Buffer.alloc(encrypted.length)
+  encrypted.copy(inPlace)
+  await mp4decrypt.decryptInPlace(inPlace, t.keys)
+
+  if (!compareSamples(srcSamples, await getSamples(inPlace))) {
+    throw new Error('In-place samples did not match')
+  }
+
+  const items = [
+    { buffer: encrypted, keys: t.keys },
+    { buffer: encrypted, keys: t.keys }
+  ]
+  const pendingBatch = mp4decrypt.decryptMany(items)
+  // the buffers are kept alive by the batch, not by the array
+  items.length = 0
+  const batch = await pendingBatch
+  for (const result of batch) {
+    if (!compareSamples(srcSamples, await getSamples(result))) {
+      throw new Error('Batch samples did not match')
+    }
+  }
+
+  const [init, segment] = splitInit(encrypted)
+  const session = mp4decrypt.createSession({ init, keys: t.keys })
+  for (let i = 0; i < 2; i++) {
+    const decSegment = await session.decrypt(segment)
+
+    if (!compareSamples(srcSamples, await getSamples(Buffer.concat([init, decSegment])))) {
+      throw new Error('Session samples did not match')
+    }
+  }
+
+  const streamed = await decryptStreamed(encrypted, t.keys, 1000)
+
+  if (!compareSamples(srcSamples, await getSamples(streamed))) {
+    throw new Error('Streamed samples did not match')
+  }
+}
+
+/**
+ * Decrypts a file through a decrypt stream, written in small chunks
+ * @param {Buffer} file
+ * @param {Record<string, string>} keys
+ * @param {number} chunkSize
+ * @returns {Promise<Buffer>}
+ */
+function decryptStreamed (file, keys, chunkSize) {
+  return new Promise((resolve, reject) => {
+    const stream = mp4decrypt.createDecryptStream(keys)
+    const outputs = []
+
+    stream.on('data', (output) => outputs.push(output))
+    stream.on('end', () => resolve(Buffer.concat(outputs)))
+    stream.on('error', reject)
+
+    for (let offset = 0; offset < file.length; offset += chunkSize) {
+      stream.write(file.subarray(offset, offset + chunkSize))
+    }
+    stream.end()
+  })
+}
+
+/**
+ * Splits a file into its init segment (everything up to the moov box)
+ * and its media segments
+ * @param {Buffer} file
+ * @returns {Buffer[]}
+ */
+function splitInit (file) {
+  let offset = 0
+  while (offset < file.length) {
+    const size = file.readUInt32BE(offset)
+    const type = file.toString('latin1', offset + 4, offset + 8)
+    offset += size
+    if (type === 'moov') break
+  }
+
+  return [file.subarray(0, offset), file.subarray(offset)]
 }
 
 function readFile (filename) {